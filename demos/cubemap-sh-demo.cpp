@@ -2,6 +2,7 @@
 #include "Camera.hpp"
 #include "Texture.hpp"
 #include "Particles.hpp"
+#include "ParticleBatch.hpp"
 #include "Mesh.hpp"
 #include "PRTMesh.hpp"
 #include "SpherePlot.hpp"
@@ -33,6 +34,10 @@ AdvectParticlesSHCubemap* flame;
 AdvectParticles*          sparks;
 AdvectParticles*          smoke;
 
+// Batches drawing the flame & smoke, one per set of textures.
+ParticleBatch* flameBatch;
+ParticleBatch* smokeBatch;
+
 PRTMesh* bunny;
 
 SpherePlot* plot;
@@ -91,6 +96,9 @@ int init()
 	const int nFlameParticles = 400;
 	const float flameIntensity = 2.31f;
 	const float flameAmbIntensity = 0.01f;
+	const float flameSmoothing = 0.5f;
+	const float flameThreshold = 0.02f; // Relative change needed to update light.
+	const int flameMinInterval = 30; // ms
 
 	/* Spark Properties */
 	const int nSparkParticles = 5;
@@ -172,6 +180,9 @@ int init()
 		bunny, nFlameParticles, pShader, flameIntensity, flameAlphaTex, flameDecayTex);
 
 	flame->ambColor = clearColor;
+	flame->filter.smoothing = flameSmoothing;
+	flame->filter.threshold = flameThreshold;
+	flame->filter.minInterval = flameMinInterval;
 
 	sparks = new AdvectParticles(
 		nSparkParticles, sShader, sparkAlphaTex, sparkDecayTex, 
@@ -191,6 +202,10 @@ int init()
 	smoke = new AdvectParticles(
 		nSmokeParticles, pShader, smokeAlphaTex, smokeDecayTex);
 
+	ParticleBatchShader* batchShader = new ParticleBatchShader("ScrollTexFireBatch");
+	flameBatch = new ParticleBatch(batchShader, flameAlphaTex, flameDecayTex);
+	smokeBatch = new ParticleBatch(batchShader, smokeAlphaTex, smokeDecayTex);
+
 	flame->translate(glm::vec3(0.0f, 0.0f, 1.0f));
 	sparks->translate(glm::vec3(0.0f, 0.0f, 1.0f));
 	smoke->translate(glm::vec3(0.0f, 1.0f, 1.0f));
@@ -275,6 +290,68 @@ void keyboard(unsigned char key, int x, int y)
 		flame->saveCubemap();
 		std::cout << "Cubemap saved to files." << std::endl;
 		break;
+	case 's':
+		flame->filter.printStats();
+		std::cout << "SH block uploads: " << scene->shManager.getNUploads() << std::endl;
+		flame->filter.resetStats();
+		break;
+	case 'l':
+		flame->layeredRender = !flame->layeredRender;
+		std::cout << "Cubemap rendered in " << 
+			(flame->layeredRender ? "one layered pass." : "six passes.") << std::endl;
+		flame->filter.resetStats();
+		break;
+	case 'g':
+		flame->setGPUProjection(!flame->getGPUProjection());
+		std::cout << "Cubemap projected on the " << 
+			(flame->getGPUProjection() ? "GPU." : "CPU.") << std::endl;
+		break;
+	case 'c':
+		flame->softwareSplat = !flame->softwareSplat;
+		std::cout << "Cubemap " << 
+			(flame->softwareSplat ? "splatted on the CPU." : "rendered with GL.") << std::endl;
+		flame->filter.resetStats();
+		break;
+	case 'a':
+		// Cycle through 6, 2 & 1 faces rendered per update.
+		flame->facesPerFrame = flame->facesPerFrame == 6 ? 2 : 
+			flame->facesPerFrame == 2 ? 1 : 6;
+		std::cout << "Cubemap faces per update: " << flame->facesPerFrame << std::endl;
+		flame->filter.resetStats();
+		break;
+	case 'e':
+		flame->prioritizeEnergy = !flame->prioritizeEnergy;
+		std::cout << "Brightest faces prioritized: " << 
+			(flame->prioritizeEnergy ? "on" : "off") << std::endl;
+		break;
+	case 'i':
+		flame->interpolate = smoke->interpolate = !flame->interpolate;
+		std::cout << "Particle interpolation: " << 
+			(flame->interpolate ? "on" : "off") << std::endl;
+		break;
+	case 'b':
+		// Toggle drawing the flame & smoke through batches.
+		if(flame->batch)
+		{
+			flameBatch->remove(flame);
+			smokeBatch->remove(smoke);
+			scene->remove(flameBatch);
+			scene->remove(smokeBatch);
+		}
+		else
+		{
+			flameBatch->add(flame);
+			smokeBatch->add(smoke);
+			scene->add(flameBatch);
+			scene->add(smokeBatch);
+		}
+		std::cout << "Flame & smoke batched: " << 
+			(flame->batch ? "on" : "off") << std::endl;
+		break;
+	case 'v':
+		std::cout << "GPU vs CPU projection, max relative error: " << 
+			flame->compareProjections() << std::endl;
+		break;
     case 'f':
     	//Switch fire mode.
     	if(flame->getShader() == tShader)
@@ -2,6 +2,9 @@
 #include "Camera.hpp"
 #include "Texture.hpp"
 #include "Particles.hpp"
+#include "GPUParticles.hpp"
+#include "MeshEmitter.hpp"
+#include "Mesh.hpp"
 #include "UserInput.hpp"
 #include "Exception.hpp"
 
@@ -94,8 +97,10 @@ int init()
 	std::cout << ">  2. Single flame with static textures." << std::endl;
 	std::cout << ">  3. Single flame with scrolling textures." << std::endl;
 	std::cout << ">  4. Single flame with procedural textures." << std::endl;
+	std::cout << ">  5. Single flame simulated on the GPU." << std::endl;
+	std::cout << ">  6. Flame spawned over the surface of a mesh." << std::endl;
 
-	int choice = UserInput::getInt(1, 4, "Please enter your choice:");
+	int choice = UserInput::getInt(1, 6, "Please enter your choice:");
 	
 	if(choice == 1) // Billboard rendering method comparison
 	{
@@ -149,6 +154,45 @@ int init()
 		scene->add(flame);
 	}
 
+	if(choice == 5)
+	{
+		int nParticles = UserInput::getInt(
+			1, 10000000, "Please enter desired no. of particles:");
+
+		GPUAdvectParticles* flame = new GPUAdvectParticles(
+			nParticles, tShader, flameAlphaTex, flameDecayTex);
+		flame->translate(glm::vec3(0.0f, -1.0f, 0.0f));
+		flame->bbHeight = 0.5f;
+		flame->bbWidth = 0.5f;
+
+		scene->add(flame);
+	}
+
+	if(choice == 6)
+	{
+		const float meshScale = 0.2f;
+
+		int nParticles = UserInput::getInt(
+			1, 1000000, "Please enter desired no. of particles:");
+
+		MeshData data = Mesh::loadSceneFile("stanford.obj");
+		for(auto v = data.v.begin(); v != data.v.end(); ++v)
+			*v = glm::vec4(glm::vec3(*v) * meshScale, 1.0f);
+
+		AdvectParticles* flame = new AdvectParticles(
+			nParticles, tShader, flameAlphaTex, flameDecayTex);
+		flame->emitter = new MeshEmitter(data);
+		flame->initVel = 0.0002f;
+		flame->centerForce = 0.0f;
+		flame->translate(glm::vec3(0.0f, -1.0f, 0.0f));
+		flame->bbHeight = 0.2f;
+		flame->bbWidth = 0.2f;
+
+		adjust = flame;
+
+		scene->add(flame);
+	}
+
 	scene->camera->translate(glm::vec3(0.0f, 0.0f, -3.0f));
 
 	return 1;
@@ -204,5 +248,19 @@ void keyboard(unsigned char key, int x, int y)
 		std::cout << centerForce << std::endl;
 		adjust->centerForce = centerForce;
 		break;
+	case 'b':
+		// Toggle a 4ms budget for the fire's update & render.
+		adjust->frameBudget = adjust->frameBudget > 0.0f ? 0.0f : 4.0f;
+		std::cout << "Particle budget: " << adjust->frameBudget << "ms" << std::endl;
+		break;
+	case 'n':
+		std::cout << "Active particles: " << adjust->getNActive() << std::endl;
+		break;
+	case 'o':
+		// Toggle LOD, at full detail down to a quarter of the screen height.
+		adjust->lodSize = adjust->lodSize > 0.0f ? 0.0f : 0.25f;
+		std::cout << "LOD size: " << adjust->lodSize << ", projected size: " 
+			<< adjust->getProjectedSize() << std::endl;
+		break;
     }
 }
@@ -3,6 +3,10 @@
 #include "Texture.hpp"
 #include "Particles.hpp"
 #include "Mesh.hpp"
+#include "ForceField.hpp"
+#include "FluidSolver.hpp"
+#include "MeshSDF.hpp"
+#include "ParticleRecording.hpp"
 #include "Exception.hpp"
 
 #include <glm.hpp>
@@ -13,6 +17,15 @@
  * This demo applies a force to the fire which varies with time. This is 
  * intended to demonstrate the way the lighting dynamically adapts to the
  * behaviour of the flame.
+ * Both flame and sparks also move through a shared curl noise force field,
+ * with a gust of wind blowing across the top of the flame. Press 'v' to
+ * toggle the field.
+ * Press 'u' to carry the flame and sparks on a fluid simulation heated from
+ * the base of the flame, and 'm' to benchmark the fluid solver.
+ * Particles collide with the bunny, using a signed distance field which is
+ * baked to ../models/ on the first run.
+ * Press 'r' to start & stop recording the flame, and 'p' to play the
+ * recording back in a loop, stepping the scene with the recorded frame times.
  */
 
 int init();
@@ -29,6 +42,14 @@ AdvectParticles*               sparks;
 
 Mesh* bunny;
 
+ForceField* field;
+FluidSolver* fluid;
+bool fluidOn = false;
+
+const std::string recordingFile = "forces-demo.prec";
+ParticleRecorder* recorder = nullptr;
+ParticleReplay* replay = nullptr;
+
 Scene* scene;
 SHLight* light;
 
@@ -148,6 +169,31 @@ int init()
 	flame->translate(glm::vec3(0.0f, 0.0f, 1.0f));
 	sparks->translate(glm::vec3(0.0f, 0.0f, 1.0f));
 
+	/* Force Field Properties */
+	const glm::vec3 fieldMin(-1.0f, -0.5f, 0.0f);
+	const glm::vec3 fieldMax( 1.0f,  2.5f, 2.0f);
+	const int fieldRes = 16;
+
+	field = new ForceField(fieldMin, fieldMax, fieldRes, fieldRes, fieldRes);
+	ForceField::Wind gust = {
+		glm::vec3(-1.0f, 1.0f, 0.0f), glm::vec3(1.0f, 2.5f, 2.0f), 
+		glm::vec3(3e-7f, 0.0f, 0.0f)};
+	field->winds.push_back(gust);
+	field->rebuild();
+
+	flame->forceField = field;
+	sparks->forceField = field;
+
+	/* Fluid Properties */
+	const glm::vec3 fluidMin(-1.0f, -0.25f, 0.0f);
+	const float fluidCellSize = 2.0f / 24.0f;
+	const int fluidWidth = 24;
+	const int fluidHeight = 36;
+
+	fluid = new FluidSolver(fluidMin, fluidCellSize, fluidWidth, fluidHeight, fluidWidth);
+	FluidSolver::HeatSource flameBase = {glm::vec3(0.0f, 0.1f, 1.0f), 0.25f, 0.005f};
+	fluid->heatSources.push_back(flameBase);
+
 	scene->add(flame);
 	scene->add(sparks);
 
@@ -166,6 +212,11 @@ int init()
 
 	scene->add(bunny);
 
+	MeshSDF* bunnySDF = MeshSDF::load("stanford.obj", "stanford.sdf");
+	AdvectParticles::Collider bunnyCollider = {bunnySDF, bunny, 0.1f, 0.3f, 0.1f};
+	flame->colliders.push_back(bunnyCollider);
+	sparks->colliders.push_back(bunnyCollider);
+
 	scene->camera->translate(glm::vec3(0.0f, 0.0f, -4.0f));
 
 	return 1;
@@ -176,7 +227,10 @@ void display()
 {
 	deTime = glutGet(GLUT_ELAPSED_TIME) - eTime;
 	eTime = glutGet(GLUT_ELAPSED_TIME);
+	if(replay) deTime = replay->peekDTime();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	field->update(deTime);
+	if(fluidOn) fluid->update(deTime);
 	scene->update(deTime);
 	flame->extForce = glm::vec4(glm::vec3(
 		6e-7f * sin(static_cast<float>(eTime) / 1000.0f), 0.0f, 0.0f ), 0.0f);
@@ -226,7 +280,70 @@ void keyboard(unsigned char key, int x, int y)
 		std::cout << flameIntensity << std::endl;
 		break;
 
+	case 'v':
+		if(flame->forceField)
+		{
+			flame->forceField = nullptr;
+			sparks->forceField = nullptr;
+		}
+		else
+		{
+			flame->forceField = field;
+			sparks->forceField = field;
+		}
+		break;
+
+	case 'u':
+		fluidOn = !fluidOn;
+		flame->fluid  = fluidOn ? fluid : nullptr;
+		sparks->fluid = fluidOn ? fluid : nullptr;
+		if(!fluidOn) fluid->reset();
+		break;
+
+	case 'm':
+		FluidSolver::benchmark();
+		break;
+
+	case 'r':
+		if(recorder)
+		{
+			flame->recorder = nullptr;
+			delete recorder;
+			recorder = nullptr;
+		}
+		else
+		{
+			recorder = new ParticleRecorder(recordingFile, 
+				static_cast<int>(flame->getParticles().size()));
+			flame->recorder = recorder;
+			std::cout << "Recording..." << std::endl;
+		}
+		break;
+
+	case 'p':
+		if(replay)
+		{
+			flame->replay = nullptr;
+			delete replay;
+			replay = nullptr;
+		}
+		else
+		{
+			try
+			{
+				replay = new ParticleReplay(recordingFile);
+				flame->replay = replay;
+			}
+			catch (Exception& e)
+			{
+				std::cout << e.msg;
+			}
+		}
+		break;
+
     case 27:
+		// exit() skips destructors, so finish any recording first.
+		delete recorder;
         exit(0);
         return;
     }
@@ -4,6 +4,8 @@
 #include "Particles.hpp"
 #include "Mesh.hpp"
 #include "PRTMesh.hpp"
+#include "SHProbeVolume.hpp"
+#include "SHClip.hpp"
 #include "UserInput.hpp"
 #include "Exception.hpp"
 
@@ -28,6 +30,11 @@ int choice = -1;
 AdvectParticlesSHCubemap* cubemapFlame;
 AdvectParticlesCentroidLights* phongFlame;
 AdvectParticlesCentroidSHLights* shFlame;
+AdvectParticlesSHProbes* probeFlame;
+AdvectParticlesSHAnalytic* analyticFlame;
+AdvectParticles* clipFlame;
+SHClipLight* clipLight;
+SHProbeVolume* probes;
 
 PRTMesh* prtBunny;
 Mesh* phongBunny;
@@ -94,11 +101,14 @@ int init()
 	std::cout << ">  3. SH with individual particles" << std::endl;
 	std::cout << ">  4. SH with particle groups" << std::endl;
 	std::cout << ">  5. SH wtih cubemap" << std::endl;
+	std::cout << ">  6. SH with probe volume" << std::endl;
+	std::cout << ">  7. SH with analytic particle projection" << std::endl;
+	std::cout << ">  8. SH with precomputed looping clip" << std::endl;
 
-	choice = UserInput::getInt(1,5,"Please enter your choice:");
+	choice = UserInput::getInt(1,8,"Please enter your choice:");
 
 	int nLights;
-	if(choice != 5) 
+	if(choice < 5) 
 		nLights = UserInput::getInt(0, GC::maxPhongLights, 
 			"Please enter desired no. of lights: ");
 
@@ -133,7 +143,7 @@ int init()
 		scene->add(phongBunny); scene->add(phongFlame);
 	}
 
-	else if(choice == 3 || choice == 4 || choice == 5)
+	else if(choice >= 3)
 	{
 		const std::string filename = "stanford.obj";
 		const std::string diffTexture = "terracotta.png";
@@ -186,6 +196,73 @@ int init()
 		cubemapFlame->setAmbIntensity(0.01f);
 	}
 
+	else if(choice == 6)
+	{
+		/* Probe Volume Properties */
+		const int probesPerFrame = 8;
+		const float probeIntensity = 0.5f;
+
+		probes = new SHProbeVolume(
+			glm::vec3(-1.5f, -1.0f, -1.0f), glm::vec3(1.5f, 1.0f, 1.0f),
+			6, 4, 4, probesPerFrame);
+
+		probeFlame = new AdvectParticlesSHProbes(
+			probes, probeIntensity, nFlameParticles, flameShader,
+			flameAlphaTex, flameDecayTex);
+
+		probeFlame->translate(flamePos);
+
+		scene->add(probeFlame);
+
+		prtBunny->setProbeVolume(probes);
+	}
+
+	else if(choice == 7)
+	{
+		analyticFlame = new AdvectParticlesSHAnalytic(
+			prtBunny, nFlameParticles, flameShader,
+			flameIntensity, flameAlphaTex, flameDecayTex);
+
+		analyticFlame->translate(flamePos);
+
+		scene->add(analyticFlame);
+
+		analyticFlame->ambColor = glm::vec4(0.7f, 0.7f, 0.9f, 1.0f);
+
+		analyticFlame->setIntensity(2.31f);
+		analyticFlame->setAmbIntensity(0.01f);
+	}
+
+	else if(choice == 8)
+	{
+		/* Clip Properties */
+		const std::string clipFilename = "fire.shclip";
+		const int clipDuration = 10000;
+
+		/* Check if clip file exists. If not, record one. */
+		if(!fileExists("../models/" + clipFilename))
+		{
+			AdvectParticlesSHAnalytic* recordFlame = new AdvectParticlesSHAnalytic(
+				prtBunny, nFlameParticles, flameShader,
+				flameIntensity, flameAlphaTex, flameDecayTex);
+			recordFlame->translate(flamePos);
+			scene->add(recordFlame);
+			SHClip::bake(recordFlame, clipFilename, clipDuration);
+			scene->remove(recordFlame);
+			delete recordFlame;
+		}
+
+		// The visible fire is simulated as usual, but its lighting is free.
+		clipFlame = new AdvectParticles(
+			nFlameParticles, flameShader, flameAlphaTex, flameDecayTex);
+		clipFlame->translate(flamePos);
+		scene->add(clipFlame);
+
+		clipLight = new SHClipLight(new SHClip(clipFilename));
+		scene->add(clipLight);
+		clipLight->setIntensity(2.31f);
+	}
+
 	scene->camera->translate(glm::vec3(0.0f, 0.0f, -3.0f));
 
 	return 1;
@@ -197,6 +274,8 @@ void display()
 	deTime = glutGet(GLUT_ELAPSED_TIME) - eTime;
 	eTime = glutGet(GLUT_ELAPSED_TIME);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Advance the clip first, so its coeffts are uploaded by this update.
+	if(clipLight) clipLight->advance(deTime);
 	scene->update(deTime);
 	scene->render();
 	glutSwapBuffers();
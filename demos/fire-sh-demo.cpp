@@ -245,6 +245,11 @@ void keyboard(unsigned char key, int x, int y)
 		}
 		showPlot = !showPlot;
 		break;
+	case 'k':
+		flame->setClustering(!flame->getClustering());
+		std::cout << "Lights placed by " << 
+			(flame->getClustering() ? "clustering." : "random clumps.") << std::endl;
+		break;
 
     case 'f':
     	//Switch fire mode.
@@ -0,0 +1,116 @@
+/* AdvectParticlesGPU
+ * Advances GPUAdvectParticles by one step of dTime ms, following the same
+ *   rules as AdvectParticles::updateBlock(). The new state is captured by
+ *   transform feedback, so nothing is rasterized.
+ * Random numbers come from hashing each particle's index with the seed,
+ *   which changes every step.
+ */
+
+-- Vertex
+#version 150
+
+in vec4 vPosDecay;    // xyz position, w decay.
+in vec4 vVelRandTex;  // xyz velocity, w randTex.
+in vec4 vTimers;      // time, lifeTime, perturbCounter, perturbTime (ms).
+
+out vec4 outPosDecay;
+out vec4 outVelRandTex;
+out vec4 outTimers;
+
+uniform float dTime;
+uniform int seed;
+
+uniform vec4 initAcn;
+uniform vec4 extForce;
+uniform float centerForce;
+
+uniform float baseRadius;
+uniform float initVel;
+uniform float initUpVel;
+uniform float avgLifetime;
+uniform float varLifetime;
+
+uniform bool perturbOn;
+uniform float perturbRadius;
+uniform float avgPerturbTime;
+uniform float varPerturbTime;
+
+const float PI = 3.141592653589793;
+
+uint hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+uint state;
+
+// Uniform random float in [0, 1].
+float rand()
+{
+	state = hash(state);
+	return float(state) / 4294967295.0;
+}
+
+// Random point in the disk of given radius in the x-z plane.
+vec3 randDisk(float radius)
+{
+	float theta = rand() * 2.0 * PI;
+	float r = rand() * radius;
+	return vec3(r * cos(theta), 0.0, r * sin(theta));
+}
+
+void main()
+{
+	state = hash(uint(gl_VertexID) ^ hash(uint(seed)));
+
+	vec3 pos = vPosDecay.xyz;
+	vec3 vel = vVelRandTex.xyz;
+	float randTex = vVelRandTex.w;
+	float time = vTimers.x + dTime;
+	float lifeTime = vTimers.y;
+	float perturbCounter = vTimers.z + dTime;
+	float perturbTime = vTimers.w;
+
+	if(time > lifeTime)
+	{
+		time = 0.0;
+		lifeTime = avgLifetime + mix(-varLifetime, varLifetime, rand());
+		perturbCounter = 0.0;
+		perturbTime = avgPerturbTime + mix(-varPerturbTime, varPerturbTime, rand());
+		pos = randDisk(baseRadius);
+		vel = pos * initVel + vec3(0.0, initUpVel, 0.0);
+		randTex = rand();
+	}
+
+	float decay = time / lifeTime;
+
+	if(perturbOn && perturbCounter >= perturbTime)
+	{
+		perturbCounter = 0.0;
+		perturbTime = avgPerturbTime + mix(-varPerturbTime, varPerturbTime, rand());
+		vel += randDisk(perturbRadius);
+	}
+
+	vel += dTime * (initAcn.xyz - vec3(pos.x, 0.0, pos.z) * centerForce) + dTime * extForce.xyz;
+	pos += dTime * vel;
+
+	outPosDecay = vec4(pos, decay);
+	outVelRandTex = vec4(vel, randTex);
+	outTimers = vec4(time, lifeTime, perturbCounter, perturbTime);
+}
+
+-- Fragment
+#version 150
+
+// Never run, as rasterization is disabled during the update.
+out vec4 outputColor;
+
+void main()
+{
+	outputColor = vec4(0.0);
+}
@@ -6,7 +6,7 @@
 -- Vertex
 #version 150
 
-in vec4 vPos;
+in vec3 vPos;
 in float vDecay;
 
 out VertexData{
@@ -24,7 +24,7 @@ uniform mat4 rotation;
 void main()
 {
 	VertexOut.decay = vDecay;
-	gl_Position = rotation * worldToObject * modelToWorld * vPos;
+	gl_Position = rotation * worldToObject * modelToWorld * vec4(vPos, 1.0);
 }
 
 -- Geometry
@@ -0,0 +1,114 @@
+/* FireLightLayered
+ * As FireLight, but renders all six faces of the cubemap in a single pass.
+ * The geometry shader emits each billboard once per face it touches,
+ *   directing it to that face's layer of a layered framebuffer via gl_Layer.
+ */
+
+-- Vertex
+#version 150
+
+in vec3 vPos;
+in float vDecay;
+
+out VertexData{
+	float decay;
+	} VertexOut;
+
+uniform mat4 modelToWorld;
+/* worldToObject transforms from world space to the model space of the
+ *   illuminated object. It is the inverse of the object's own modelToWorld
+ *   matrix.
+ */
+uniform mat4 worldToObject;
+
+void main()
+{
+	VertexOut.decay = vDecay;
+	gl_Position = worldToObject * modelToWorld * vec4(vPos, 1.0);
+}
+
+-- Geometry
+#version 150
+
+uniform float bbWidth;
+uniform float bbHeight;
+uniform mat4 perspective;
+// Rotation taking object space to the view space of each cubemap face.
+uniform mat4 faceRotations[6];
+
+layout(points) in;
+
+layout(triangle_strip, max_vertices = 24) out;
+
+in VertexData {
+	float decay;
+} VertexIn[];
+
+out float decay;
+out vec2 bbPos;
+
+// Corners in triangle strip order: bottom left, top left, bottom right, top right.
+const vec2 corners[4] = vec2[4](
+	vec2(0.0, 0.0), vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0));
+
+void main()
+{
+	for(int face = 0; face < 6; ++face)
+	{
+		vec3 pointPos = (faceRotations[face] * gl_in[0].gl_Position).xyz;
+
+		vec4 clipPos[4];
+		bvec4 left, right, below, above, behind;
+		for(int i = 0; i < 4; ++i)
+		{
+			vec3 corner = pointPos +
+				vec3((corners[i] - vec2(0.5, 0.5)) * vec2(bbWidth, bbHeight), 0.0);
+			clipPos[i] = perspective * vec4(corner, 1.0);
+			left[i]   = clipPos[i].x < -clipPos[i].w;
+			right[i]  = clipPos[i].x >  clipPos[i].w;
+			below[i]  = clipPos[i].y < -clipPos[i].w;
+			above[i]  = clipPos[i].y >  clipPos[i].w;
+			behind[i] = clipPos[i].z < -clipPos[i].w;
+		}
+
+		// Skip faces the billboard lies entirely outside of.
+		if(all(left) || all(right) || all(below) || all(above) || all(behind))
+			continue;
+
+		for(int i = 0; i < 4; ++i)
+		{
+			gl_Layer = face;
+			gl_Position = clipPos[i];
+			decay = VertexIn[0].decay;
+			bbPos = corners[i];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
+
+-- Fragment
+#version 150
+
+in float decay;
+in vec2 bbPos;
+
+out vec4 outputColor;
+
+uniform sampler2D decayTexture;
+uniform float globalAlpha;
+
+void main()
+{
+	vec2 fromCenter = (bbPos - vec2(0.5, 0.5)) * 2.0;
+	float centerDistSq = clamp(dot(fromCenter, fromCenter), 0.0, 1.0);
+
+	float fade = (1 - centerDistSq);
+
+	float alpha = fade*fade*fade * ( decay < 0.3 ? decay : (1 - decay) );
+	if (alpha < 0.05) discard;
+	alpha *= globalAlpha;
+
+	outputColor = vec4(texture2D(decayTexture, vec2(decay, 0.0)).xyz, alpha);
+	outputColor = clamp(outputColor, vec4(0.9, 0.9, 0.9, 1.0), vec4(1.0, 1.0, 1.0, 1.0));
+}
@@ -0,0 +1,32 @@
+/* ParticleCentroid
+ * Sums the positions of GPUAdvectParticles, weighted by brightness, into a
+ *   single pixel with additive blending. The result has the weighted sum of
+ *   positions in xyz & the total weight in w.
+ */
+
+-- Vertex
+#version 150
+
+in vec4 vPosDecay;
+
+out vec4 weighted;
+
+void main()
+{
+	float decay = vPosDecay.w;
+	float weight = decay < 0.3 ? decay : (1.0 - decay);
+	weighted = vec4(vPosDecay.xyz * weight, weight);
+	gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+-- Fragment
+#version 150
+
+in vec4 weighted;
+
+out vec4 outputColor;
+
+void main()
+{
+	outputColor = weighted;
+}
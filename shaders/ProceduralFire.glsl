@@ -12,7 +12,7 @@
 
 uniform mat4 modelToWorld;
 
-in vec4 vPos;
+in vec3 vPos;
 in float vDecay;
 in float vRandTex;
 
@@ -25,7 +25,7 @@ void main()
 {
 	VertexOut.decay = vDecay;
 	VertexOut.randTex = vRandTex;
-	gl_Position = modelToWorld * vPos;
+	gl_Position = modelToWorld * vec4(vPos, 1.0);
 }
 
 -- Geometry
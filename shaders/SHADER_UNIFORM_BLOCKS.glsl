@@ -38,3 +38,15 @@ layout(std140) uniform SHBlock
 	vec3 lightCoeffts[$nSHCoeffts$ * $maxSHLights$];
 	uint nLights;
 };
+
+//INDEX = 4
+struct Emitter
+{
+	mat4 modelToWorld;
+	vec4 bbSizeAlpha; // bbWidth, bbHeight, globalAlpha, unused.
+};
+
+layout(std140) uniform emitterBlock
+{
+	Emitter emitters[$maxBatchEmitters$];
+};
@@ -0,0 +1,111 @@
+/* SHProjectCubemap
+ * First pass of SHReduction. Renders to a target nSHCoeffts texels wide
+ *   and 6 * faceSize texels high. The texel in column c and row r holds
+ *   the contribution of row r of the cubemap (faces stacked one above the
+ *   other) to SH coefft c: the sum over the row of colour * basis * solid angle.
+ */
+
+-- Vertex
+#version 150
+
+// Full screen quad, drawn as a 4 vertex triangle strip with no attributes.
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
+
+-- Fragment
+#version 150
+
+out vec4 coefft;
+
+uniform sampler2DArray cubemap;
+uniform int faceSize;
+
+const float PI = 3.14159265358979;
+
+/* Direction through point (s, t) in [-1, 1]^2 on the given face, matching
+ *   AdvectParticlesSHCubemap::cubemapLookup().
+ */
+vec3 faceDir(int face, float s, float t)
+{
+	if(face == 0) return vec3( 1.0,    t,   -s);
+	if(face == 1) return vec3(-1.0,   -t,   -s);
+	if(face == 2) return vec3(   s,  1.0,   -t);
+	if(face == 3) return vec3(  -s, -1.0,   -t);
+	if(face == 4) return vec3(   s,    t,  1.0);
+	return               vec3(   s,   -t, -1.0);
+}
+
+/* Real SH basis function SHI(l, m) in (normalised) direction dir.
+ * Uses the same trig free recurrences as SH::evalBasis().
+ */
+float shBasis(int l, int m, vec3 dir)
+{
+	int am = abs(m);
+
+	// (x + iy)^|m| and P_|m|^|m|(z) / sin^|m|(theta).
+	float c = 1.0;
+	float s = 0.0;
+	float pmm = 1.0;
+	for(int i = 1; i <= am; ++i)
+	{
+		float cNext = c * dir.x - s * dir.y;
+		s = c * dir.y + s * dir.x;
+		c = cNext;
+		pmm *= -float(2*i - 1);
+	}
+
+	// Raise l to find P_l^|m|(z) / sin^|m|(theta).
+	float pPrev = 0.0;
+	float pCurr = pmm;
+	for(int i = am + 1; i <= l; ++i)
+	{
+		float pNext = (i == am + 1) ? 
+			dir.z * float(2*am + 1) * pmm :
+			(dir.z * float(2*i - 1) * pCurr - float(i + am - 1) * pPrev) / float(i - am);
+		pPrev = pCurr;
+		pCurr = pNext;
+	}
+
+	// K(l, |m|) = sqrt((2l+1)/4PI * (l-|m|)!/(l+|m|)!)
+	float factRatio = 1.0;
+	for(int i = l - am + 1; i <= l + am; ++i)
+		factRatio /= float(i);
+	float k = sqrt(float(2*l + 1) / (4.0 * PI) * factRatio);
+
+	if(m == 0) return k * pCurr;
+	if(m > 0)  return sqrt(2.0) * k * c * pCurr;
+	return sqrt(2.0) * k * s * pCurr;
+}
+
+void main()
+{
+	int index = int(gl_FragCoord.x);
+	int l = int(sqrt(float(index)) + 0.001);
+	int m = index - l*l - l;
+
+	int row = int(gl_FragCoord.y);
+	int face = row / faceSize;
+	int t_p = row - face * faceSize;
+
+	float texelSize = 2.0 / float(faceSize);
+	float t = (float(t_p) + 0.5) * texelSize - 1.0;
+
+	vec3 sum = vec3(0.0);
+	for(int s_p = 0; s_p < faceSize; ++s_p)
+	{
+		float s = (float(s_p) + 0.5) * texelSize - 1.0;
+		float distSq = 1.0 + s*s + t*t;
+
+		// Solid angle subtended by the texel.
+		float solidAngle = texelSize * texelSize / (distSq * sqrt(distSq));
+		vec3 dir = faceDir(face, s, t) / sqrt(distSq);
+
+		vec3 color = texelFetch(cubemap, ivec3(s_p, t_p, face), 0).xyz;
+		sum += color * (shBasis(l, m, dir) * solidAngle);
+	}
+
+	coefft = vec4(sum, 0.0);
+}
@@ -0,0 +1,50 @@
+/* SHReduce
+ * Reduction pass of SHReduction. Each texel sums a block of blockSize 
+ *   rows of the same column of the source texture, so repeated passes
+ *   leave a single row holding the SH coeffts.
+ * The sum is multiplied by scale, and if addBlock is set the current
+ *   contents of the SHBlock are added, so the result can be copied 
+ *   straight back into the SHBlock buffer.
+ */
+
+-- Vertex
+#version 150
+
+// Full screen quad, drawn as a 4 vertex triangle strip with no attributes.
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
+
+-- Fragment
+#version 150
+
+out vec4 coefft;
+
+uniform sampler2D src;
+uniform int srcRows;
+uniform int blockSize;
+uniform vec3 scale;
+uniform bool addBlock;
+
+layout(std140) uniform SHBlock
+{
+	vec4 lightCoeffts[$nSHCoeffts$];
+};
+
+void main()
+{
+	ivec2 dst = ivec2(gl_FragCoord.xy);
+	int first = dst.y * blockSize;
+	int last = min(first + blockSize, srcRows);
+
+	vec3 sum = vec3(0.0);
+	for(int row = first; row < last; ++row)
+		sum += texelFetch(src, ivec2(dst.x, row), 0).xyz;
+
+	sum *= scale;
+	if(addBlock) sum += lightCoeffts[dst.x].xyz;
+
+	coefft = vec4(sum, 0.0);
+}
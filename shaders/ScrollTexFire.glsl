@@ -6,9 +6,12 @@
 -- Vertex
 #version 150
 
+/* Positions may arrive quantized to the unit box (see PackedAdvectParticle),
+ *   in which case modelToWorld also scales them back out to model space.
+ */
 uniform mat4 modelToWorld;
 
-in vec4 vPos;
+in vec3 vPos;
 in float vDecay;
 in float vRandTex;
 
@@ -21,7 +24,7 @@ void main()
 {
 	VertexOut.decay = vDecay;
 	VertexOut.randTex = vRandTex;
-	gl_Position = modelToWorld * vPos;
+	gl_Position = modelToWorld * vec4(vPos, 1.0);
 }
 
 -- Geometry
@@ -9,7 +9,7 @@
 
 uniform mat4 modelToWorld;
 
-in vec4 vPos;
+in vec3 vPos;
 in float vDecay;
 
 out VertexData{
@@ -19,7 +19,7 @@ out VertexData{
 void main()
 {
 	VertexOut.decay = vDecay;
-	gl_Position = modelToWorld * vPos;
+	gl_Position = modelToWorld * vec4(vPos, 1.0);
 }
 
 -- Geometry
@@ -0,0 +1,51 @@
+#ifndef ALIGNEDALLOCATOR_HPP
+#define ALIGNEDALLOCATOR_HPP
+
+#include <xmmintrin.h>
+
+#include <cstddef>
+#include <new>
+
+/* AlignedAllocator
+ * Allocator for std::vector giving storage aligned to Alignment bytes, so
+ *   that SIMD code can use aligned loads & stores (e.g. 32 for AVX).
+ */
+template<typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind {typedef AlignedAllocator<U, Alignment> other;};
+
+	AlignedAllocator() {};
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {};
+
+	pointer address(reference r) const {return &r;};
+	const_pointer address(const_reference r) const {return &r;};
+	size_type max_size() const {return static_cast<size_type>(-1) / sizeof(T);};
+
+	pointer allocate(size_type n, const void* = 0)
+	{
+		void* p = _mm_malloc(n * sizeof(T), Alignment);
+		if(!p) throw std::bad_alloc();
+		return static_cast<pointer>(p);
+	};
+	void deallocate(pointer p, size_type) {_mm_free(p);};
+
+	void construct(pointer p, const T& val) {new (p) T(val);};
+	void destroy(pointer p) {p->~T();};
+
+	bool operator==(const AlignedAllocator&) const {return true;};
+	bool operator!=(const AlignedAllocator&) const {return false;};
+};
+
+#endif
@@ -34,6 +34,7 @@ public:
 	void setRot(const float& theta, const float& phi);
 
 	void setFOV(const float& newFOV);
+	float getFOV() const {return FOV;}; // Vertical field of view (degrees).
 	void setAspect(const float& newAspect);
 	void setZNear(const float& newZNear);
 	void setZFar(const float& newZFar);
@@ -0,0 +1,115 @@
+#include "CubemapSplatter.hpp"
+
+#include "GC.hpp"
+
+#include <omp.h>
+
+#include <algorithm>
+
+CubemapSplatter::CubemapSplatter(int faceSize, bool saturate)
+	:saturate(saturate), faceSize(faceSize), facePixels(faceSize * faceSize)
+{
+	faces.assign(6 * facePixels, glm::vec4(0.0f));
+}
+
+void CubemapSplatter::splat(
+	const AdvectParticle* particles, int n,
+	const glm::mat4& toTarget,
+	float bbWidth, float bbHeight,
+	const std::vector<glm::vec4>& colors,
+	const glm::vec4& clearColor)
+{
+	// Clip planes of the perspective set by CubemapShader.
+	const float zNear = 0.01f;
+	const float zFar = 50.0f;
+	const float texelSize = 2.0f / faceSize;
+
+	glm::mat4 toFace[6];
+	for(int face = 0; face < 6; ++face)
+		toFace[face] = AdvectParticlesSHCubemap::getRotation(face) * toTarget;
+
+	int nThreads = omp_get_max_threads();
+	partial.assign(nThreads * 6 * facePixels, glm::vec3(0.0f));
+
+	#pragma omp parallel
+	{
+		glm::vec3* acc = &partial[omp_get_thread_num() * 6 * facePixels];
+
+		#pragma omp for
+		for(int i = 0; i < n; ++i)
+		{
+			float decay = particles[i].decay;
+			float decayIntensity = decay < 0.3f ? decay : (1.0f - decay);
+			if(decayIntensity < 0.05f) continue; // Every fragment is discarded.
+
+			// FireLight.glsl clamps colour to [0.9, 1] and alpha to 1, so 
+			// every fragment passing the alpha test adds the same colour.
+			int pixel = static_cast<int>(decay * (colors.size()-1));
+			glm::vec3 color = glm::clamp(glm::vec3(colors[pixel]), 
+				glm::vec3(0.9f), glm::vec3(1.0f));
+
+			for(int face = 0; face < 6; ++face)
+			{
+				glm::vec4 pos = toFace[face] * particles[i].pos;
+				float depth = -pos.z;
+				if(depth <= zNear || depth >= zFar) continue;
+
+				// Billboard is parallel to the face, so its extent in device
+				// coords is found by dividing its corners by depth.
+				float left   = (pos.x - 0.5f*bbWidth)  / depth;
+				float right  = (pos.x + 0.5f*bbWidth)  / depth;
+				float bottom = (pos.y - 0.5f*bbHeight) / depth;
+				float top    = (pos.y + 0.5f*bbHeight) / depth;
+
+				// Texels with centres inside the billboard.
+				int c0 = std::max(0, static_cast<int>(ceil((left + 1.0f) / texelSize - 0.5f)));
+				int c1 = std::min(faceSize-1, static_cast<int>(ceil((right + 1.0f) / texelSize - 0.5f)) - 1);
+				int r0 = std::max(0, static_cast<int>(ceil((bottom + 1.0f) / texelSize - 0.5f)));
+				int r1 = std::min(faceSize-1, static_cast<int>(ceil((top + 1.0f) / texelSize - 0.5f)) - 1);
+
+				glm::vec3* faceAcc = acc + face * facePixels;
+
+				for(int r = r0; r <= r1; ++r)
+				{
+					float y = (r + 0.5f) * texelSize - 1.0f;
+					float bbY = (y * depth - (pos.y - 0.5f*bbHeight)) / bbHeight;
+					float fromCenterY = (bbY - 0.5f) * 2.0f;
+
+					for(int c = c0; c <= c1; ++c)
+					{
+						float x = (c + 0.5f) * texelSize - 1.0f;
+						float bbX = (x * depth - (pos.x - 0.5f*bbWidth)) / bbWidth;
+						float fromCenterX = (bbX - 0.5f) * 2.0f;
+
+						float centerDistSq = std::min(1.0f, 
+							fromCenterX*fromCenterX + fromCenterY*fromCenterY);
+						float fade = 1.0f - centerDistSq;
+						if(fade*fade*fade * decayIntensity < 0.05f) continue;
+
+						faceAcc[r*faceSize + c] += color;
+					}
+				}
+			}
+		}
+
+		// Sum the threads' faces.
+		#pragma omp for
+		for(int texel = 0; texel < 6 * facePixels; ++texel)
+		{
+			glm::vec3 sum(clearColor);
+			for(int t = 0; t < nThreads; ++t)
+				sum += partial[t * 6 * facePixels + texel];
+			if(saturate) sum = glm::min(sum, glm::vec3(1.0f));
+			faces[texel] = glm::vec4(sum, clearColor.w);
+		}
+	}
+}
+
+std::vector<glm::vec3> CubemapSplatter::project() const
+{
+	std::vector<glm::vec3> coeffts(GC::nSHCoeffts, glm::vec3(0.0f));
+	for(int face = 0; face < 6; ++face)
+		AdvectParticlesSHCubemap::projectFace(&faces[face * facePixels], faceSize, 
+			face, coeffts.data());
+	return coeffts;
+}
@@ -0,0 +1,56 @@
+#ifndef CUBEMAPSPLATTER_HPP
+#define CUBEMAPSPLATTER_HPP
+
+#include "Particles.hpp"
+
+#include <glm.hpp>
+
+#include <vector>
+
+/* CubemapSplatter
+ * Software rasterizer producing the same cubemap as AdvectParticlesSHCubemap
+ *   renders with FireLight.glsl, but on the CPU with no GL context. Used for
+ *   lighting bakes, tests and benchmarks with no display.
+ * Each billboard is splatted into each face using the same rotations,
+ *   projection and fragment rules as the shader. Every fragment passing the 
+ *   shader's alpha test adds the (clamped) decay texture colour.
+ * Particles are split among threads, each splatting into its own copy of 
+ *   the faces, which are then summed.
+ */
+class CubemapSplatter
+{
+public:
+	/* If saturate is true, texels are clamped to 1 as in a GL_RGBA8 target,
+	 *   otherwise they behave as a float target.
+	 */
+	CubemapSplatter(int faceSize, bool saturate = true);
+
+	/* Splats n particles around the origin of the space toTarget transforms 
+	 *   them to (as for AdvectParticlesSHCubemap, the illuminated object's 
+	 *   model space). colors should hold the decay texture (see 
+	 *   AdvectParticles::loadImage()).
+	 */
+	void splat(
+		const AdvectParticle* particles, int n,
+		const glm::mat4& toTarget,
+		float bbWidth, float bbHeight,
+		const std::vector<glm::vec4>& colors,
+		const glm::vec4& clearColor);
+
+	/* Projects the faces onto SH, integrating over every texel. */
+	std::vector<glm::vec3> project() const;
+
+	/* Faces in the same layout as read back from GL: one after another,
+	 *   each faceSize * faceSize texels with the bottom row first.
+	 */
+	const std::vector<glm::vec4>& getFaces() const {return faces;};
+	int getFaceSize() const {return faceSize;};
+	bool saturate;
+private:
+	int faceSize;
+	int facePixels;
+	std::vector<glm::vec4> faces;
+	std::vector<glm::vec3> partial; // Per-thread faces.
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "FluidSolver.hpp"
+
+#include "Exception.hpp"
+#include "GC.hpp"
+
+#include <omp.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+FluidSolver::FluidSolver(const glm::vec3& boxMin, float cellSize, int nx, int ny, int nz)
+	:buoyancy(1e-6f), cooling(0.002f), vorticity(0.001f),
+	 pressureIterations(20), maxStep(33),
+	 boxMin(boxMin), cellSize(cellSize),
+	 nx(nx), ny(ny), nz(nz),
+	 sx(nx + 2), sy(ny + 2), sz(nz + 2)
+{
+	if(nx < 2 || ny < 2 || nz < 2)
+		throw Exception("FluidSolver requires at least 2 cells along each axis.\n");
+	if(cellSize <= 0.0f)
+		throw Exception("FluidSolver requires a positive cell size.\n");
+
+	FloatArray* fields[] = {
+		&velX, &velY, &velZ, &temp, 
+		&newVelX, &newVelY, &newVelZ, &newTemp,
+		&pressure, &newPressure, &divergence,
+		&curlX, &curlY, &curlZ, &curlMag};
+	const int nFields = sizeof(fields) / sizeof(fields[0]);
+	for(int f = 0; f < nFields; ++f)
+		fields[f]->resize(sx * sy * sz, 0.0f);
+}
+
+void FluidSolver::update(int dTime)
+{
+	if(dTime <= 0) return;
+	step(static_cast<float>(std::min(dTime, maxStep)));
+}
+
+void FluidSolver::reset()
+{
+	std::fill(velX.begin(), velX.end(), 0.0f);
+	std::fill(velY.begin(), velY.end(), 0.0f);
+	std::fill(velZ.begin(), velZ.end(), 0.0f);
+	std::fill(temp.begin(), temp.end(), 0.0f);
+	std::fill(pressure.begin(), pressure.end(), 0.0f);
+}
+
+void FluidSolver::step(float dt)
+{
+	addHeat(dt);
+	addBuoyancy(dt);
+	confineVorticity(dt);
+	advect(dt);
+	project();
+}
+
+void FluidSolver::toGrid(const glm::vec3& pos, float& gx, float& gy, float& gz) const
+{
+	// Cell centres lie at integer coords, ghost cells at 0 & n+1.
+	gx = (pos.x - boxMin.x) / cellSize + 0.5f;
+	gy = (pos.y - boxMin.y) / cellSize + 0.5f;
+	gz = (pos.z - boxMin.z) / cellSize + 0.5f;
+}
+
+float FluidSolver::interpolate(const FloatArray& f, float gx, float gy, float gz) const
+{
+	gx = std::max(0.0f, std::min(gx, static_cast<float>(sx-1)));
+	gy = std::max(0.0f, std::min(gy, static_cast<float>(sy-1)));
+	gz = std::max(0.0f, std::min(gz, static_cast<float>(sz-1)));
+
+	int x0 = std::min(static_cast<int>(gx), sx-2);
+	int y0 = std::min(static_cast<int>(gy), sy-2);
+	int z0 = std::min(static_cast<int>(gz), sz-2);
+
+	float tx = gx - x0;
+	float ty = gy - y0;
+	float tz = gz - z0;
+
+	int i = index(x0, y0, z0);
+	int dy = sx, dz = sx * sy;
+
+	float c00 = f[i]         + tx * (f[i + 1]           - f[i]);
+	float c10 = f[i + dy]    + tx * (f[i + dy + 1]      - f[i + dy]);
+	float c01 = f[i + dz]    + tx * (f[i + dz + 1]      - f[i + dz]);
+	float c11 = f[i + dy+dz] + tx * (f[i + dy + dz + 1] - f[i + dy + dz]);
+	float c0 = c00 + ty * (c10 - c00);
+	float c1 = c01 + ty * (c11 - c01);
+	return c0 + tz * (c1 - c0);
+}
+
+glm::vec3 FluidSolver::sampleVelocity(const glm::vec3& pos) const
+{
+	float gx, gy, gz;
+	toGrid(pos, gx, gy, gz);
+	return glm::vec3(
+		interpolate(velX, gx, gy, gz),
+		interpolate(velY, gx, gy, gz),
+		interpolate(velZ, gx, gy, gz));
+}
+
+void FluidSolver::sampleVelocity(const float* x, const float* y, const float* z, int count,
+	float* vx, float* vy, float* vz) const
+{
+	for(int i = 0; i < count; ++i)
+	{
+		glm::vec3 vel = sampleVelocity(glm::vec3(x[i], y[i], z[i]));
+		vx[i] = vel.x;
+		vy[i] = vel.y;
+		vz[i] = vel.z;
+	}
+}
+
+float FluidSolver::sampleTemperature(const glm::vec3& pos) const
+{
+	float gx, gy, gz;
+	toGrid(pos, gx, gy, gz);
+	return interpolate(temp, gx, gy, gz);
+}
+
+void FluidSolver::addHeat(float dt)
+{
+	for(auto s = heatSources.begin(); s != heatSources.end(); ++s)
+	{
+		float gx, gy, gz;
+		toGrid(s->pos, gx, gy, gz);
+		float r = s->radius / cellSize;
+		int xMin = std::max(1, static_cast<int>(floor(gx - r))), xMax = std::min(nx, static_cast<int>(ceil(gx + r)));
+		int yMin = std::max(1, static_cast<int>(floor(gy - r))), yMax = std::min(ny, static_cast<int>(ceil(gy + r)));
+		int zMin = std::max(1, static_cast<int>(floor(gz - r))), zMax = std::min(nz, static_cast<int>(ceil(gz + r)));
+
+		#pragma omp parallel for
+		for(int z = zMin; z <= zMax; ++z)
+			for(int y = yMin; y <= yMax; ++y)
+				for(int x = xMin; x <= xMax; ++x)
+				{
+					float dist = glm::length(glm::vec3(x - gx, y - gy, z - gz));
+					if(dist < r)
+						temp[index(x, y, z)] += dt * s->rate * (1.0f - dist / r);
+				}
+	}
+}
+
+void FluidSolver::addBuoyancy(float dt)
+{
+	int n = static_cast<int>(velY.size());
+	float scale = dt * buoyancy;
+	float* v = velY.data();
+	const float* t = temp.data();
+
+	#pragma omp parallel for
+	for(int i = 0; i < n; ++i)
+		v[i] += scale * t[i];
+}
+
+void FluidSolver::confineVorticity(float dt)
+{
+	if(vorticity == 0.0f) return;
+
+	const int dy = sx, dz = sx * sy;
+	const float halfInvH = 0.5f / cellSize;
+
+	// Curl of velocity, by central differences.
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+		{
+			int row = index(1, y, z);
+			for(int i = row; i < row + nx; ++i)
+			{
+				float cx = ((velZ[i+dy] - velZ[i-dy]) - (velY[i+dz] - velY[i-dz])) * halfInvH;
+				float cy = ((velX[i+dz] - velX[i-dz]) - (velZ[i+1]  - velZ[i-1]))  * halfInvH;
+				float cz = ((velY[i+1]  - velY[i-1])  - (velX[i+dy] - velX[i-dy])) * halfInvH;
+				curlX[i] = cx;
+				curlY[i] = cy;
+				curlZ[i] = cz;
+				curlMag[i] = sqrt(cx*cx + cy*cy + cz*cz);
+			}
+		}
+	setBoundary(curlMag);
+
+	// Push along N x curl, where N points up the gradient of |curl|.
+	const float scale = dt * vorticity * cellSize;
+
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+		{
+			int row = index(1, y, z);
+			for(int i = row; i < row + nx; ++i)
+			{
+				glm::vec3 n(
+					curlMag[i+1]  - curlMag[i-1],
+					curlMag[i+dy] - curlMag[i-dy],
+					curlMag[i+dz] - curlMag[i-dz]);
+				float len = glm::length(n);
+				if(len < EPS) continue;
+				glm::vec3 f = glm::cross(n / len, glm::vec3(curlX[i], curlY[i], curlZ[i]));
+				velX[i] += scale * f.x;
+				velY[i] += scale * f.y;
+				velZ[i] += scale * f.z;
+			}
+		}
+}
+
+void FluidSolver::advect(float dt)
+{
+	setBoundary(velX);
+	setBoundary(velY);
+	setBoundary(velZ);
+	setBoundary(temp);
+
+	const float toCells = dt / cellSize;
+	const float keep = exp(-cooling * dt);
+
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+			for(int x = 1; x <= nx; ++x)
+			{
+				int i = index(x, y, z);
+				float gx = x - toCells * velX[i];
+				float gy = y - toCells * velY[i];
+				float gz = z - toCells * velZ[i];
+				newVelX[i] = interpolate(velX, gx, gy, gz);
+				newVelY[i] = interpolate(velY, gx, gy, gz);
+				newVelZ[i] = interpolate(velZ, gx, gy, gz);
+				newTemp[i] = keep * interpolate(temp, gx, gy, gz);
+			}
+
+	velX.swap(newVelX);
+	velY.swap(newVelY);
+	velZ.swap(newVelZ);
+	temp.swap(newTemp);
+}
+
+void FluidSolver::project()
+{
+	setBoundary(velX);
+	setBoundary(velY);
+	setBoundary(velZ);
+
+	const int dy = sx, dz = sx * sy;
+	const float halfH = 0.5f * cellSize;
+
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+		{
+			int row = index(1, y, z);
+			for(int i = row; i < row + nx; ++i)
+				divergence[i] = halfH * (
+					(velX[i+1]  - velX[i-1]) +
+					(velY[i+dy] - velY[i-dy]) +
+					(velZ[i+dz] - velZ[i-dz]));
+		}
+
+	for(int iter = 0; iter < pressureIterations; ++iter)
+	{
+		setBoundary(pressure);
+
+		#pragma omp parallel for
+		for(int z = 1; z <= nz; ++z)
+			for(int y = 1; y <= ny; ++y)
+				jacobiRow(index(1, y, z), nx);
+
+		pressure.swap(newPressure);
+	}
+	setBoundary(pressure);
+
+	const float halfInvH = 0.5f / cellSize;
+
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+		{
+			int row = index(1, y, z);
+			for(int i = row; i < row + nx; ++i)
+			{
+				velX[i] -= halfInvH * (pressure[i+1]  - pressure[i-1]);
+				velY[i] -= halfInvH * (pressure[i+dy] - pressure[i-dy]);
+				velZ[i] -= halfInvH * (pressure[i+dz] - pressure[i-dz]);
+			}
+		}
+}
+
+void FluidSolver::jacobiRow(int first, int count)
+{
+	const int dy = sx, dz = sx * sy;
+	const float sixth = 1.0f / 6.0f;
+	const float* p = pressure.data();
+	const float* d = divergence.data();
+	float* out = newPressure.data();
+
+	int i = first;
+#ifdef __AVX2__
+	const __m256 sixth8 = _mm256_set1_ps(sixth);
+	for(; i + 8 <= first + count; i += 8)
+	{
+		__m256 sum = _mm256_add_ps(
+			_mm256_add_ps(_mm256_loadu_ps(p + i - 1),  _mm256_loadu_ps(p + i + 1)),
+			_mm256_add_ps(_mm256_loadu_ps(p + i - dy), _mm256_loadu_ps(p + i + dy)));
+		sum = _mm256_add_ps(sum, 
+			_mm256_add_ps(_mm256_loadu_ps(p + i - dz), _mm256_loadu_ps(p + i + dz)));
+		_mm256_storeu_ps(out + i, 
+			_mm256_mul_ps(_mm256_sub_ps(sum, _mm256_loadu_ps(d + i)), sixth8));
+	}
+#endif
+	for(; i < first + count; ++i)
+		out[i] = (p[i-1] + p[i+1] + p[i-dy] + p[i+dy] + p[i-dz] + p[i+dz] - d[i]) * sixth;
+}
+
+void FluidSolver::setBoundary(FloatArray& f)
+{
+	// Copy each face of the interior out to its ghost cells, one axis at a
+	//   time so that edges & corners are filled too.
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int y = 1; y <= ny; ++y)
+		{
+			f[index(0, y, z)]    = f[index(1, y, z)];
+			f[index(sx-1, y, z)] = f[index(nx, y, z)];
+		}
+
+	#pragma omp parallel for
+	for(int z = 1; z <= nz; ++z)
+		for(int x = 0; x < sx; ++x)
+		{
+			f[index(x, 0, z)]    = f[index(x, 1, z)];
+			f[index(x, sy-1, z)] = f[index(x, ny, z)];
+		}
+
+	#pragma omp parallel for
+	for(int y = 0; y < sy; ++y)
+		for(int x = 0; x < sx; ++x)
+		{
+			f[index(x, y, 0)]    = f[index(x, y, 1)];
+			f[index(x, y, sz-1)] = f[index(x, y, nz)];
+		}
+}
+
+void FluidSolver::benchmark(int nSteps)
+{
+	const int sizes[] = {32, 64, 96, 128};
+	const int nSizes = sizeof(sizes) / sizeof(sizes[0]);
+	const int warmupSteps = 2;
+	const int dTime = 16;
+
+	std::cout << "FluidSolver benchmark: " << nSteps << " steps, " 
+		<< omp_get_max_threads() << " threads." << std::endl;
+
+	for(int s = 0; s < nSizes; ++s)
+	{
+		int n = sizes[s];
+		FluidSolver solver(glm::vec3(-1.0f, 0.0f, -1.0f), 2.0f / n, n, n, n);
+		HeatSource source = {glm::vec3(0.0f, 0.2f, 0.0f), 0.3f, 0.005f};
+		solver.heatSources.push_back(source);
+
+		for(int i = 0; i < warmupSteps; ++i)
+			solver.update(dTime);
+
+		std::chrono::high_resolution_clock::time_point start = 
+			std::chrono::high_resolution_clock::now();
+		for(int i = 0; i < nSteps; ++i)
+			solver.update(dTime);
+		float ms = std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - start).count() / nSteps;
+
+		float cells = static_cast<float>(n) * n * n;
+		std::cout << "  " << n << "^3: " << ms << " ms/step, "
+			<< cells / (ms * 1000.0f) << " Mcells/s" << std::endl;
+	}
+}
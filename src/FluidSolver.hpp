@@ -0,0 +1,92 @@
+#ifndef FLUIDSOLVER_HPP
+#define FLUIDSOLVER_HPP
+
+#include "AlignedAllocator.hpp"
+
+#include <glm.hpp>
+
+#include <vector>
+
+/* FluidSolver
+ * A "stable fluids" smoke solver on a coarse grid of nx * ny * nz cubic
+ *   cells of side cellSize, with its minimum corner at boxMin in world space.
+ * Each step:
+ *   - Heat sources add temperature, which makes the air rise (buoyancy).
+ *   - Vorticity confinement puts back small swirls lost to numerical 
+ *     diffusion, at a strength set by vorticity.
+ *   - Velocity & temperature are advected semi-Lagrangian (traced back 
+ *     along the velocity, then trilinearly interpolated), and temperature
+ *     cools exponentially.
+ *   - The velocity is made divergence free by solving for pressure with
+ *     pressureIterations Jacobi iterations, warm started from the last step.
+ * Fields are stored with a layer of ghost cells around the grid, copied
+ *   from their neighbours, so the edges of the box are open & every 
+ *   interior cell can be updated the same way. Work is split into z slabs
+ *   across threads, and the Jacobi rows use AVX2 where available.
+ * Units follow AdvectParticles: distances in world units, times in ms.
+ * AdvectParticles::fluid can be set to a FluidSolver to carry particles 
+ *   with the flow.
+ */
+class FluidSolver
+{
+public:
+	struct HeatSource
+	{
+		glm::vec3 pos;
+		float radius;
+		float rate; // Temperature added per ms at the centre.
+	};
+
+	FluidSolver(const glm::vec3& boxMin, float cellSize, int nx, int ny, int nz);
+
+	// Steps the solver by dTime ms, clamped to maxStep for stability.
+	void update(int dTime);
+	void reset();
+
+	glm::vec3 sampleVelocity(const glm::vec3& pos) const;
+	/* Samples count points, given & returned as separate x, y & z arrays. */
+	void sampleVelocity(const float* x, const float* y, const float* z, int count,
+		float* vx, float* vy, float* vz) const;
+	float sampleTemperature(const glm::vec3& pos) const;
+
+	/* Times nSteps steps of a heated solver for grid sizes from 32^3 to 
+	 *   128^3, and prints the results to std::cout.
+	 */
+	static void benchmark(int nSteps = 20);
+
+	float buoyancy;  // Upwards acceleration per unit temperature.
+	float cooling;   // Fraction of temperature lost per ms.
+	float vorticity;
+	int pressureIterations;
+	int maxStep;
+	std::vector<HeatSource> heatSources;
+
+	const glm::vec3 boxMin;
+	const float cellSize;
+	const int nx, ny, nz;
+private:
+	typedef std::vector<float, AlignedAllocator<float, 32>> FloatArray;
+
+	// Indices include the ghost cells, so interior cells are [1, n].
+	int index(int x, int y, int z) const {return x + sx*(y + sy*z);};
+	void toGrid(const glm::vec3& pos, float& gx, float& gy, float& gz) const;
+	float interpolate(const FloatArray& f, float gx, float gy, float gz) const;
+
+	void step(float dt);
+	void addHeat(float dt);
+	void addBuoyancy(float dt);
+	void confineVorticity(float dt);
+	void advect(float dt);
+	void project();
+	void jacobiRow(int first, int count);
+	void setBoundary(FloatArray& f);
+
+	int sx, sy, sz;
+	FloatArray velX, velY, velZ, temp;
+	FloatArray newVelX, newVelY, newVelZ, newTemp;
+	FloatArray pressure, newPressure;
+	FloatArray divergence; // Scaled by cellSize^2, ready for the Jacobi update.
+	FloatArray curlX, curlY, curlZ, curlMag;
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "ForceField.hpp"
+
+#include "Exception.hpp"
+#include "GC.hpp"
+
+#include <algorithm>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static unsigned int hash(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static float latticeValue(int x, int y, int z, unsigned int seed)
+{
+	unsigned int h = hash(static_cast<unsigned int>(x) ^ 
+		hash(static_cast<unsigned int>(y) ^ 
+		hash(static_cast<unsigned int>(z) ^ hash(seed))));
+	return static_cast<float>(h) / 2147483647.5f - 1.0f;
+}
+
+static float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+/* Smooth value noise, in [-1, 1], with a different pattern for each seed. */
+static float valueNoise(const glm::vec3& p, unsigned int seed)
+{
+	int x0 = static_cast<int>(floor(p.x));
+	int y0 = static_cast<int>(floor(p.y));
+	int z0 = static_cast<int>(floor(p.z));
+	float tx = fade(p.x - x0);
+	float ty = fade(p.y - y0);
+	float tz = fade(p.z - z0);
+
+	float result = 0.0f;
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+		float weight = 
+			(dx ? tx : 1.0f - tx) *
+			(dy ? ty : 1.0f - ty) *
+			(dz ? tz : 1.0f - tz);
+		result += weight * latticeValue(x0 + dx, y0 + dy, z0 + dz, seed);
+	}
+	return result;
+}
+
+ForceField::ForceField(
+	const glm::vec3& boxMin, const glm::vec3& boxMax,
+	int nx, int ny, int nz,
+	int slicesPerUpdate)
+	:noiseStrength(3e-7f), noiseScale(0.3f), noiseSpeed(0.0003f),
+	 slicesPerUpdate(slicesPerUpdate),
+	 boxMin(boxMin), boxMax(boxMax),
+	 nx(nx), ny(ny), nz(nz),
+	 time(0.0f), nextSlice(0)
+{
+	if(nx < 2 || ny < 2 || nz < 2)
+		throw Exception("ForceField requires at least 2 cells along each axis.\n");
+
+	spacing = (boxMax - boxMin) /
+		glm::vec3(static_cast<float>(nx-1), static_cast<float>(ny-1), static_cast<float>(nz-1));
+
+	forceX.resize(nx * ny * nz, 0.0f);
+	forceY.resize(nx * ny * nz, 0.0f);
+	forceZ.resize(nx * ny * nz, 0.0f);
+
+	rebuild();
+}
+
+void ForceField::update(int dTime)
+{
+	time += static_cast<float>(dTime);
+
+	int count = std::min(slicesPerUpdate, nz);
+
+	#pragma omp parallel for
+	for(int i = 0; i < count; ++i)
+		computeSlice((nextSlice + i) % nz);
+
+	nextSlice = (nextSlice + count) % nz;
+}
+
+void ForceField::rebuild()
+{
+	#pragma omp parallel for
+	for(int z = 0; z < nz; ++z)
+		computeSlice(z);
+}
+
+glm::vec3 ForceField::getCellPos(int x, int y, int z) const
+{
+	return boxMin + spacing * glm::vec3(
+		static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+}
+
+void ForceField::computeSlice(int z)
+{
+	for(int y = 0; y < ny; ++y)
+		for(int x = 0; x < nx; ++x)
+		{
+			glm::vec3 pos = getCellPos(x, y, z);
+			glm::vec3 force(0.0f);
+
+			if(noiseStrength != 0.0f)
+				force += noiseStrength * curlNoise(pos);
+
+			for(auto w = winds.begin(); w != winds.end(); ++w)
+				if(pos.x >= w->boxMin.x && pos.y >= w->boxMin.y && pos.z >= w->boxMin.z &&
+					pos.x <= w->boxMax.x && pos.y <= w->boxMax.y && pos.z <= w->boxMax.z)
+					force += w->force;
+
+			for(auto a = attractors.begin(); a != attractors.end(); ++a)
+			{
+				glm::vec3 toAttractor = a->pos - pos;
+				float dist = glm::length(toAttractor);
+				if(dist < EPS || dist > a->radius) continue;
+				force += toAttractor * (a->strength * (1.0f - dist / a->radius) / dist);
+			}
+
+			int cell = cellIndex(x, y, z);
+			forceX[cell] = force.x;
+			forceY[cell] = force.y;
+			forceZ[cell] = force.z;
+		}
+}
+
+glm::vec3 ForceField::curlNoise(const glm::vec3& pos) const
+{
+	// Potential is three independent noise fields, scrolling upwards.
+	glm::vec3 p = pos / noiseScale - glm::vec3(0.0f, time * noiseSpeed / noiseScale, 0.0f);
+	const float e = 0.01f;
+	const glm::vec3 dx(e, 0.0f, 0.0f), dy(0.0f, e, 0.0f), dz(0.0f, 0.0f, e);
+
+	// Central differences of each potential component.
+	float dPzdy = valueNoise(p + dy, 2) - valueNoise(p - dy, 2);
+	float dPydz = valueNoise(p + dz, 1) - valueNoise(p - dz, 1);
+	float dPxdz = valueNoise(p + dz, 0) - valueNoise(p - dz, 0);
+	float dPzdx = valueNoise(p + dx, 2) - valueNoise(p - dx, 2);
+	float dPydx = valueNoise(p + dx, 1) - valueNoise(p - dx, 1);
+	float dPxdy = valueNoise(p + dy, 0) - valueNoise(p - dy, 0);
+
+	return glm::vec3(dPzdy - dPydz, dPxdz - dPzdx, dPydx - dPxdy) / (2.0f * e);
+}
+
+glm::vec3 ForceField::sample(const glm::vec3& pos) const
+{
+	glm::vec3 force;
+	sampleScalar(pos.x, pos.y, pos.z, &force.x, &force.y, &force.z);
+	return force;
+}
+
+void ForceField::sample(const float* x, const float* y, const float* z, int count,
+	float* fx, float* fy, float* fz) const
+{
+	int i = 0;
+#ifdef __AVX2__
+	for(; i + 8 <= count; i += 8)
+		sampleAVX2(x + i, y + i, z + i, fx + i, fy + i, fz + i);
+#endif
+	for(; i < count; ++i)
+		sampleScalar(x[i], y[i], z[i], fx + i, fy + i, fz + i);
+}
+
+void ForceField::sampleScalar(float x, float y, float z, 
+	float* fx, float* fy, float* fz) const
+{
+	// Find position in grid space, clamped to the field.
+	float gx = std::max(0.0f, std::min((x - boxMin.x) / spacing.x, static_cast<float>(nx-1)));
+	float gy = std::max(0.0f, std::min((y - boxMin.y) / spacing.y, static_cast<float>(ny-1)));
+	float gz = std::max(0.0f, std::min((z - boxMin.z) / spacing.z, static_cast<float>(nz-1)));
+
+	int x0 = std::min(static_cast<int>(gx), nx-2);
+	int y0 = std::min(static_cast<int>(gy), ny-2);
+	int z0 = std::min(static_cast<int>(gz), nz-2);
+
+	float tx = gx - x0;
+	float ty = gy - y0;
+	float tz = gz - z0;
+
+	*fx = *fy = *fz = 0.0f;
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+		float weight =
+			(dx ? tx : 1.0f - tx) *
+			(dy ? ty : 1.0f - ty) *
+			(dz ? tz : 1.0f - tz);
+		int cell = cellIndex(x0 + dx, y0 + dy, z0 + dz);
+		*fx += weight * forceX[cell];
+		*fy += weight * forceY[cell];
+		*fz += weight * forceZ[cell];
+	}
+}
+
+#ifdef __AVX2__
+void ForceField::sampleAVX2(const float* x, const float* y, const float* z, 
+	float* fx, float* fy, float* fz) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	// Grid space coords, clamped to the field.
+	__m256 g[3];
+	__m256i i0[3];
+	const float* p[3] = {x, y, z};
+	const int n[3] = {nx, ny, nz};
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		__m256 coord = _mm256_div_ps(
+			_mm256_sub_ps(_mm256_loadu_ps(p[axis]), _mm256_set1_ps(boxMin[axis])),
+			_mm256_set1_ps(spacing[axis]));
+		coord = _mm256_max_ps(zero, 
+			_mm256_min_ps(coord, _mm256_set1_ps(static_cast<float>(n[axis]-1))));
+		i0[axis] = _mm256_min_epi32(_mm256_cvttps_epi32(coord), _mm256_set1_epi32(n[axis]-2));
+		g[axis] = _mm256_sub_ps(coord, _mm256_cvtepi32_ps(i0[axis]));
+	}
+
+	__m256i base = _mm256_add_epi32(i0[0], _mm256_mullo_epi32(_mm256_set1_epi32(nx),
+		_mm256_add_epi32(i0[1], _mm256_mullo_epi32(_mm256_set1_epi32(ny), i0[2]))));
+
+	__m256 sumX = zero, sumY = zero, sumZ = zero;
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+		__m256 weight = _mm256_mul_ps(
+			_mm256_mul_ps(
+				dx ? g[0] : _mm256_sub_ps(one, g[0]),
+				dy ? g[1] : _mm256_sub_ps(one, g[1])),
+			dz ? g[2] : _mm256_sub_ps(one, g[2]));
+		__m256i cell = _mm256_add_epi32(base, _mm256_set1_epi32(dx + nx*(dy + ny*dz)));
+
+		sumX = _mm256_add_ps(sumX, _mm256_mul_ps(weight, _mm256_i32gather_ps(forceX.data(), cell, 4)));
+		sumY = _mm256_add_ps(sumY, _mm256_mul_ps(weight, _mm256_i32gather_ps(forceY.data(), cell, 4)));
+		sumZ = _mm256_add_ps(sumZ, _mm256_mul_ps(weight, _mm256_i32gather_ps(forceZ.data(), cell, 4)));
+	}
+
+	_mm256_storeu_ps(fx, sumX);
+	_mm256_storeu_ps(fy, sumY);
+	_mm256_storeu_ps(fz, sumZ);
+}
+#endif
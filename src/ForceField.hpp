@@ -0,0 +1,87 @@
+#ifndef FORCEFIELD_HPP
+#define FORCEFIELD_HPP
+
+#include "AlignedAllocator.hpp"
+
+#include <glm.hpp>
+
+#include <vector>
+
+/* ForceField
+ * A regular grid of force vectors filling the box [boxMin, boxMax] in world
+ *   space, with nx * ny * nz cells on the box's corners & along its edges,
+ *   which may be shared by any number of particle systems.
+ * Each cell holds the sum of:
+ *   - Curl noise: a divergence free, swirling field, found as the curl of 
+ *     a noise potential. The noise scrolls upwards over time at noiseSpeed,
+ *     giving rising turbulence. noiseScale is the size of the swirls.
+ *   - Winds: a constant force inside each of a number of boxes.
+ *   - Attractors: a force towards (or, with negative strength, away from) a
+ *     point, fading out linearly to zero at radius.
+ * Forces are in the same units as AdvectParticles::extForce (per ms^2).
+ * update() recomputes slicesPerUpdate z slices at a time in round-robin
+ *   order, so keeping the field animated has a fixed, small cost per frame.
+ *   Call rebuild() after changing winds or attractors to see them at once.
+ * sample() finds forces by trilinear interpolation, 8 points at a time 
+ *   with AVX2 where available. Points outside the box are clamped to it.
+ */
+class ForceField
+{
+public:
+	struct Wind
+	{
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		glm::vec3 force;
+	};
+
+	struct Attractor
+	{
+		glm::vec3 pos;
+		float strength;
+		float radius;
+	};
+
+	ForceField(
+		const glm::vec3& boxMin, const glm::vec3& boxMax,
+		int nx, int ny, int nz,
+		int slicesPerUpdate = 4);
+
+	void update(int dTime);
+	void rebuild();
+
+	glm::vec3 sample(const glm::vec3& pos) const;
+	/* Samples count points, given & returned as separate x, y & z arrays. */
+	void sample(const float* x, const float* y, const float* z, int count,
+		float* fx, float* fy, float* fz) const;
+
+	float noiseStrength;
+	float noiseScale;
+	float noiseSpeed;
+	std::vector<Wind> winds;
+	std::vector<Attractor> attractors;
+
+	int slicesPerUpdate;
+	const glm::vec3 boxMin;
+	const glm::vec3 boxMax;
+	const int nx, ny, nz;
+private:
+	typedef std::vector<float, AlignedAllocator<float, 32>> FloatArray;
+
+	int cellIndex(int x, int y, int z) const {return x + nx*(y + ny*z);};
+	glm::vec3 getCellPos(int x, int y, int z) const;
+	void computeSlice(int z);
+	glm::vec3 curlNoise(const glm::vec3& pos) const;
+	void sampleScalar(float x, float y, float z, float* fx, float* fy, float* fz) const;
+#ifdef __AVX2__
+	void sampleAVX2(const float* x, const float* y, const float* z, 
+		float* fx, float* fy, float* fz) const;
+#endif
+
+	glm::vec3 spacing;
+	float time;
+	int nextSlice;
+	FloatArray forceX, forceY, forceZ;
+};
+
+#endif
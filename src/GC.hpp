@@ -19,8 +19,12 @@ namespace GC
 	const int maxSHLights = 10;
 	const int nSHBounces = 5;
 	const bool jitterSamples = false;
-	const int cubemapSize = 256;
-	const int cubemapPixels = cubemapSize * cubemapSize;
+	const int cubemapSize = 256; // Default, see AdvectParticlesSHCubemap.
+	const int nCubemapReadbacks = 3; // Frames of cubemap readback in flight.
+
+	/* Vertex streaming */
+	const int nStreamRegions = 3; // Frames of vertex data in flight.
+	const int maxBatchEmitters = 200; // Limited by 16KB minimum UBO size.
 
 	/* AO */
 	const int sqrtAOSamples = 10;
@@ -0,0 +1,316 @@
+#include "GPUParticles.hpp"
+
+#include "Shader.hpp"
+#include "Texture.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+
+static float randf(float low, float high)
+{
+	float r = (float) rand() / (float) RAND_MAX;
+	return low + ((high - low) * r);
+}
+
+GPUAdvectParticles::GPUAdvectParticles(int maxParticles,
+	ParticleShader* shader, 
+	Texture* bbTex, Texture* decayTex, bool texScrolls, bool additive)
+	:ParticleSystem(maxParticles, shader),
+	 extForce(glm::vec4(0.0f)),
+	 avgLifetime(3000), varLifetime(200),
+	 initAcn(glm::vec4(0.0, 0.0000004, 0.0, 0.0)),
+	 initVel(0.001f),
+	 initUpVel(0.0f),
+	 avgPerturbTime(1000), varPerturbTime(100),
+	 perturbRadius(0.0001f),
+	 baseRadius(0.2f),
+	 centerForce(6e-7f),
+	 perturbOn(true),
+	 bbHeight(0.3f), bbWidth(0.3f),
+	 simStep(10), maxSubsteps(10),
+	 additive(additive), bbTex(bbTex), decayTex(decayTex), texScrolls(texScrolls),
+	 current(0), seed(0), accumulator(0),
+	 nextReadback(0), centroid(0.0f)
+{
+	updateShader = new ParticleUpdateShader("AdvectParticlesGPU");
+	centroidShader = new Shader(false, "ParticleCentroid", false, false);
+
+	// Initial state, with lifetimes evenly spaced so the system stabilises quickly.
+	std::vector<GPUParticle> particles(maxParticles);
+	for(int i = 0; i < maxParticles; ++i)
+	{
+		float theta = randf(0.0f, 2.0f * PI);
+		float radius = randf(0.0f, baseRadius);
+		glm::vec3 pos(radius*cos(theta), 0.0f, radius*sin(theta));
+		glm::vec3 vel = pos * initVel + glm::vec3(0.0f, initUpVel, 0.0f);
+		particles[i].posDecay = glm::vec4(pos, 0.0f);
+		particles[i].velRandTex = glm::vec4(vel, randf(0.0f, 1.0f));
+		particles[i].timers = glm::vec4(
+			0.0f, 
+			static_cast<float>((avgLifetime * i) / maxParticles),
+			0.0f,
+			avgPerturbTime + randf(-float(varPerturbTime), float(varPerturbTime)));
+	}
+
+	glGenBuffers(2, buffers);
+	for(int i = 0; i < 2; ++i)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(GPUParticle),
+			particles.data(), GL_DYNAMIC_COPY);
+	}
+
+	// Update VAOs read from one buffer while feedback writes the other.
+	GLuint posDecay_attrib = updateShader->getAttribLoc("vPosDecay");
+	GLuint velRandTex_attrib = updateShader->getAttribLoc("vVelRandTex");
+	GLuint timers_attrib = updateShader->getAttribLoc("vTimers");
+	GLuint centroid_attrib = centroidShader->getAttribLoc("vPosDecay");
+
+	glGenVertexArrays(2, updateVAO);
+	glGenVertexArrays(2, centroidVAO);
+	for(int i = 0; i < 2; ++i)
+	{
+		glBindVertexArray(updateVAO[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+		glEnableVertexAttribArray(posDecay_attrib);
+		glEnableVertexAttribArray(velRandTex_attrib);
+		glEnableVertexAttribArray(timers_attrib);
+		glVertexAttribPointer(posDecay_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle),
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, posDecay)));
+		glVertexAttribPointer(velRandTex_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle),
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, velRandTex)));
+		glVertexAttribPointer(timers_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle),
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, timers)));
+
+		glBindVertexArray(centroidVAO[i]);
+		glEnableVertexAttribArray(centroid_attrib);
+		glVertexAttribPointer(centroid_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle),
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, posDecay)));
+	}
+	glBindVertexArray(0);
+
+	glGenVertexArrays(2, renderVAO);
+	setShader(shader);
+
+	// Single pixel float target for summing the centroid.
+	glGenRenderbuffers(1, &centroidRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, centroidRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, 1, 1);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &centroidFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, centroidFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+		GL_RENDERBUFFER, centroidRenderbuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(GC::nCubemapReadbacks, centroidPBOs.data());
+	for(int i = 0; i < GC::nCubemapReadbacks; ++i)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, centroidPBOs[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_READ);
+		centroidFences[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GPUAdvectParticles::~GPUAdvectParticles()
+{
+	for(int i = 0; i < GC::nCubemapReadbacks; ++i)
+		if(centroidFences[i]) glDeleteSync(centroidFences[i]);
+	glDeleteBuffers(GC::nCubemapReadbacks, centroidPBOs.data());
+	glDeleteFramebuffers(1, &centroidFramebuffer);
+	glDeleteRenderbuffers(1, &centroidRenderbuffer);
+	glDeleteVertexArrays(2, updateVAO);
+	glDeleteVertexArrays(2, renderVAO);
+	glDeleteVertexArrays(2, centroidVAO);
+	glDeleteBuffers(2, buffers);
+	delete updateShader;
+	delete centroidShader;
+}
+
+void GPUAdvectParticles::setShader(ParticleShader* shader)
+{
+	this->shader = shader;
+
+	shader->setBBTexUnit(bbTex->getTexUnit());
+	shader->setDecayTexUnit(decayTex->getTexUnit());
+
+	// Render straight from the state buffers: position, decay & randTex are
+	//   read from their places in each GPUParticle.
+	GLuint pos_attrib = shader->getAttribLoc("vPos");
+	GLuint decay_attrib = shader->getAttribLoc("vDecay");
+
+	for(int i = 0; i < 2; ++i)
+	{
+		glBindVertexArray(renderVAO[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+		glEnableVertexAttribArray(pos_attrib);
+		glEnableVertexAttribArray(decay_attrib);
+		glVertexAttribPointer(pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(GPUParticle),
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, posDecay)));
+		glVertexAttribPointer(decay_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), 
+			reinterpret_cast<GLvoid*>(offsetof(GPUParticle, posDecay) + 3*sizeof(float)));
+		if(texScrolls)
+		{
+			GLuint randTex_attrib = shader->getAttribLoc("vRandTex");
+			glEnableVertexAttribArray(randTex_attrib);
+			glVertexAttribPointer(randTex_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), 
+				reinterpret_cast<GLvoid*>(offsetof(GPUParticle, velRandTex) + 3*sizeof(float)));
+		}
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GPUAdvectParticles::update(int dTime)
+{
+	updateShader->setForces(initAcn, extForce, centerForce);
+	updateShader->setSpawn(baseRadius, initVel, initUpVel,
+		static_cast<float>(avgLifetime), static_cast<float>(varLifetime));
+	updateShader->setPerturb(perturbOn, perturbRadius,
+		static_cast<float>(avgPerturbTime), static_cast<float>(varPerturbTime));
+
+	accumulator = std::min(accumulator + dTime, maxSubsteps * simStep);
+	bool stepped = false;
+	while(accumulator >= simStep)
+	{
+		step(simStep);
+		accumulator -= simStep;
+		stepped = true;
+	}
+
+	if(stepped) sumCentroid();
+}
+
+void GPUAdvectParticles::step(int dTime)
+{
+	updateShader->setStep(static_cast<float>(dTime), seed++);
+	updateShader->use();
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(updateVAO[current]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1 - current]);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, maxParticles);
+	glEndTransformFeedback();
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glUseProgram(0);
+
+	current = 1 - current;
+}
+
+void GPUAdvectParticles::sumCentroid()
+{
+	GLint prevFramebuffer;
+	GLint viewport[4];
+	GLboolean blend;
+	GLint blendSrc, blendDst;
+	GLfloat clearCol[4];
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetBooleanv(GL_BLEND, &blend);
+	glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrc);
+	glGetIntegerv(GL_BLEND_DST_RGB, &blendDst);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearCol);
+
+	// Every particle lands on the one pixel, so blending sums them.
+	glBindFramebuffer(GL_FRAMEBUFFER, centroidFramebuffer);
+	glViewport(0, 0, 1, 1);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	centroidShader->use();
+	glBindVertexArray(centroidVAO[current]);
+	glDrawArrays(GL_POINTS, 0, maxParticles);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	// Queue copy of the sum, to be read once the GPU has caught up.
+	if(centroidFences[nextReadback]) 
+	{
+		// Ring is full: drop the oldest sum, rather than wait for it.
+		glDeleteSync(centroidFences[nextReadback]);
+		centroidFences[nextReadback] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, centroidPBOs[nextReadback]);
+	glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	centroidFences[nextReadback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nextReadback = (nextReadback + 1) % GC::nCubemapReadbacks;
+
+	// Take the latest sum which has finished, oldest first.
+	for(int i = 0; i < GC::nCubemapReadbacks; ++i)
+	{
+		int slot = (nextReadback + i) % GC::nCubemapReadbacks;
+		if(centroidFences[slot]) readCentroid(slot);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glClearColor(clearCol[0], clearCol[1], clearCol[2], clearCol[3]);
+	glBlendFunc(blendSrc, blendDst);
+	if(blend == GL_TRUE) glEnable(GL_BLEND);
+	else glDisable(GL_BLEND);
+}
+
+bool GPUAdvectParticles::readCentroid(int slot)
+{
+	GLenum status = glClientWaitSync(centroidFences[slot], 0, 0);
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+
+	glDeleteSync(centroidFences[slot]);
+	centroidFences[slot] = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, centroidPBOs[slot]);
+	const glm::vec4* sum = static_cast<const glm::vec4*>(glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER, 0, sizeof(glm::vec4), GL_MAP_READ_BIT));
+	if(sum)
+	{
+		if(sum->w > EPS)
+			centroid = glm::vec4(glm::vec3(*sum) / sum->w, sum->w);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	return true;
+}
+
+void GPUAdvectParticles::render()
+{
+	if(!scene) return;
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND); 
+	if(additive)
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	shader->setModelToWorld(modelToWorld);
+	shader->setAlpha(alpha);
+	shader->setBBTexUnit(bbTex->getTexUnit());
+	shader->setDecayTexUnit(decayTex->getTexUnit());
+	shader->setBBHeight(bbHeight);
+	shader->setBBWidth(bbWidth);
+
+	shader->use();
+
+	glBindVertexArray(renderVAO[current]);
+	glDrawArrays(GL_POINTS, 0, maxParticles);
+	glBindVertexArray(0);
+
+	glUseProgram(0);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+}
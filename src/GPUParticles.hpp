@@ -0,0 +1,98 @@
+#ifndef GPUPARTICLES_HPP
+#define GPUPARTICLES_HPP
+
+#include "Particles.hpp"
+#include "GC.hpp"
+
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include <array>
+
+class Texture;
+class ParticleShader;
+class ParticleUpdateShader;
+
+/* GPUAdvectParticles
+ * Behaves as AdvectParticles, but keeps all particle state in GPU buffers
+ *   & advances it with a transform feedback vertex shader 
+ *   (AdvectParticlesGPU.glsl), so no particle data passes over the bus.
+ * State is ping-ponged between two buffers each step, & rendered directly
+ *   from the most recent one with the usual ParticleShaders.
+ * As with AdvectParticles, the simulation runs in fixed steps of simStep ms.
+ *   Particles are drawn at their last simulated positions (no interpolation).
+ * The only data read back is the brightness-weighted centroid of the
+ *   particles, summed on the GPU & read asynchronously, a few frames late.
+ *   This may be used to place lights, for example.
+ */
+class GPUAdvectParticles : public ParticleSystem
+{
+public:
+	GPUAdvectParticles(int maxParticles, ParticleShader* shader,
+		Texture* bbTex, Texture* decayTex, bool texScrolls = true, bool additive = true);
+	~GPUAdvectParticles();
+
+	void render();
+	void update(int dTime);
+	void setShader(ParticleShader* shader);
+
+	/* Centroid of the particles in model space, weighted by brightness.
+	 * w is the total weight (0 until the first readback completes).
+	 */
+	glm::vec4 getCentroid() const {return centroid;};
+
+	glm::vec4 extForce;
+	int avgLifetime;
+	int varLifetime;
+	glm::vec4 initAcn;
+	float initVel;
+	float initUpVel;
+	int avgPerturbTime;
+	int varPerturbTime;
+	float perturbRadius;
+	float baseRadius;
+	float centerForce;
+	bool perturbOn;
+	float bbHeight;
+	float bbWidth;
+
+	int simStep;
+	int maxSubsteps;
+private:
+	// Matches the inputs & outputs of AdvectParticlesGPU.glsl.
+	struct GPUParticle
+	{
+		glm::vec4 posDecay;
+		glm::vec4 velRandTex;
+		glm::vec4 timers; // time, lifeTime, perturbCounter, perturbTime.
+	};
+
+	void step(int dTime);
+	void sumCentroid();
+	bool readCentroid(int slot);
+
+	bool additive;
+	Texture* bbTex;
+	Texture* decayTex;
+	bool texScrolls;
+
+	ParticleUpdateShader* updateShader;
+	Shader* centroidShader;
+
+	GLuint buffers[2];
+	GLuint updateVAO[2];
+	GLuint renderVAO[2];
+	GLuint centroidVAO[2];
+	int current; // Index of the buffer holding the latest state.
+	int seed;
+	int accumulator;
+
+	GLuint centroidFramebuffer;
+	GLuint centroidRenderbuffer;
+	std::array<GLuint, GC::nCubemapReadbacks> centroidPBOs;
+	std::array<GLsync, GC::nCubemapReadbacks> centroidFences;
+	int nextReadback;
+	glm::vec4 centroid;
+};
+
+#endif
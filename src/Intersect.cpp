@@ -68,6 +68,44 @@ glm::vec3 getTriangleRayIntersection(
 	return glm::vec3(u, v, t); // u, v in range - intersection.
 }
 
+glm::vec3 closestPointOnTriangle(const glm::vec3& p,
+	const glm::vec3& ta, const glm::vec3& tb, const glm::vec3& tc)
+{
+	// Find which Voronoi region of the triangle p lies in, see
+	//   Ericson, Real-Time Collision Detection, 5.1.5.
+	glm::vec3 ab = tb - ta;
+	glm::vec3 ac = tc - ta;
+	glm::vec3 ap = p - ta;
+	float d1 = glm::dot(ab, ap);
+	float d2 = glm::dot(ac, ap);
+	if(d1 <= 0.0f && d2 <= 0.0f) return ta;
+
+	glm::vec3 bp = p - tb;
+	float d3 = glm::dot(ab, bp);
+	float d4 = glm::dot(ac, bp);
+	if(d3 >= 0.0f && d4 <= d3) return tb;
+
+	float vc = d1*d4 - d3*d2;
+	if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return ta + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp = p - tc;
+	float d5 = glm::dot(ab, cp);
+	float d6 = glm::dot(ac, cp);
+	if(d6 >= 0.0f && d5 <= d6) return tc;
+
+	float vb = d5*d2 - d1*d6;
+	if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return ta + ac * (d2 / (d2 - d6));
+
+	float va = d3*d6 - d5*d4;
+	if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return tb + (tc - tb) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return ta + ab * (vb * denom) + ac * (vc * denom);
+}
+
 bool pointInTriangle(const glm::vec2& point, 
 	const glm::vec2& ta, const glm::vec2& tb, const glm::vec2& tc,
 	float& s, float& t)
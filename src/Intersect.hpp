@@ -25,6 +25,10 @@ glm::vec3 getTriangleRayIntersection(
 	const glm::vec3& ta, const glm::vec3& tb, const glm::vec3& tc,
 	const glm::vec3& ro, const glm::vec3& rd);
 
+/* Finds the point on triangle (ta, tb, tc) closest to p. */
+glm::vec3 closestPointOnTriangle(const glm::vec3& p,
+	const glm::vec3& ta, const glm::vec3& tb, const glm::vec3& tc);
+
 bool pointInTriangle(const glm::vec2& point, 
 	const glm::vec2& ta, const glm::vec2& tb, const glm::vec2& tc,
 	float& s, float& t);
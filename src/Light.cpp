@@ -56,18 +56,21 @@ void SHLight::setCoeffts(std::vector<glm::vec3> coeffts)
 {
 	this->coeffts = coeffts;
 	retCoeffts = rotation * coeffts * intensity * color;
+	changed();
 }
 
 void SHLight::rotateCoeffts(const glm::mat4& rotation)
 {
 	this->rotation = SHMat(rotation, GC::nSHBands);
 	retCoeffts = this->rotation * coeffts * intensity * color;
+	changed();
 }
 
 void SHLight::rotateCoeffts(const SHMat& rotation)
 {
 	this->rotation = rotation;
 	retCoeffts = this->rotation * coeffts * intensity * color;
+	changed();
 }
 
 void SHLight::pointAt(glm::vec3 dir)
@@ -87,16 +90,24 @@ void SHLight::pointAt(glm::vec3 dir)
 		look,
 		GC::nSHBands);
 	retCoeffts = rotation * coeffts * intensity * color;
+	changed();
 }
 
 void SHLight::setIntensity(float intensity)
 {
 	this->intensity = intensity;
 	retCoeffts = rotation * coeffts * intensity * color;
+	changed();
 }
 
 void SHLight::setColor(const glm::vec3& color)
 {
 	this->color = color;
 	retCoeffts = rotation * coeffts * intensity * color;
+	changed();
+}
+
+void SHLight::changed()
+{
+	if(manager) manager->markChanged();
 }
@@ -84,6 +84,7 @@ public:
 	glm::vec3 getColor() {return color;};
 	void setColor(const glm::vec3& color);
 private:
+	void changed();
 	std::vector<glm::vec3> coeffts;
 	std::vector<glm::vec3> retCoeffts;
 	SHMat rotation;
@@ -105,6 +106,7 @@ void SHLight::setFunc(Fn func)
 {
 	coeffts = SH::shProject(GC::sqrtSHSamples, GC::nSHBands, func);
 	retCoeffts = rotation * coeffts * intensity;
+	changed();
 }
 
 #endif
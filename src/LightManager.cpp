@@ -1,5 +1,7 @@
 #include "LightManager.hpp"
 
+#include "SHReduction.hpp"
+
 #include <algorithm>
 
 PhongLightManager::PhongLightManager()
@@ -82,6 +84,7 @@ void PhongLightManager::updateBlock()
 }
 
 SHLightManager::SHLightManager()
+	:changed(true), nUploads(0)
 {
 	glGenBuffers(1, &block_ubo);
 	glBindBufferRange(GL_UNIFORM_BUFFER, Shader::getUBlockBindingIndex("SHBlock"),
@@ -97,6 +100,7 @@ SHLight* SHLightManager::add(SHLight* l)
 	if(l == nullptr || l->manager != nullptr) return nullptr;
 	lights.insert(l);
 	l->manager = this;
+	changed = true;
 	return l;
 }
 
@@ -104,11 +108,15 @@ SHLight* SHLightManager::remove(SHLight* l)
 {
 	lights.erase(l);
 	l->manager = nullptr;
+	changed = true;
 	return l;
 }
 
 void SHLightManager::update()
 {
+	if(!changed) return;
+	changed = false;
+
 	std::fill(block.lightCoeffts, block.lightCoeffts + GC::nSHCoeffts,
 		glm::vec4(0.0f));
 
@@ -119,7 +127,43 @@ void SHLightManager::update()
 			block.lightCoeffts[c] += glm::vec4(lc.x, lc.y, lc.z, 0.0f);
 		}
 
+	updateBlock();
+}
+
+void SHLightManager::uploadWithExtra(const std::vector<glm::vec3>& extra)
+{
+	SHBlock local = block;
+	for(int c = 0; c < GC::nSHCoeffts && c < static_cast<int>(extra.size()); ++c)
+		local.lightCoeffts[c] += glm::vec4(extra[c].x, extra[c].y, extra[c].z, 0.0f);
+
+	upload(local);
+}
+
+void SHLightManager::updateBlock()
+{
+	++nUploads;
+	upload(block);
+}
+
+void SHLightManager::addGPUSource(SHReduction* source)
+{
+	if(source == nullptr) return;
+	gpuSources.insert(source);
+	changed = true;
+}
+
+void SHLightManager::removeGPUSource(SHReduction* source)
+{
+	gpuSources.erase(source);
+	changed = true;
+}
+
+void SHLightManager::upload(const SHBlock& block)
+{
 	glBindBuffer(GL_UNIFORM_BUFFER, block_ubo);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &(block));
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	for(auto s = gpuSources.begin(); s != gpuSources.end(); ++s)
+		(*s)->addTo(block_ubo);
 }
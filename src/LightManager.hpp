@@ -11,6 +11,7 @@
 
 class PhongLight;
 class SHLight;
+class SHReduction;
 
 
 struct phongBlock
@@ -53,10 +54,32 @@ public:
 	SHLight* add(SHLight* l);
 	void update();
 	SHLight* remove(SHLight* l);
+	/* Uploads the summed coeffts of the managed lights, plus extra, 
+	 *   leaving the stored block unchanged. Used by objects with their
+	 *   own local lighting (e.g. from an SHProbeVolume). 
+	 * Call updateBlock() after rendering to restore the block.
+	 */
+	void uploadWithExtra(const std::vector<glm::vec3>& extra);
+	void updateBlock();
+	/* Called by lights when their coeffts change. update() only rebuilds
+	 *   and uploads the block if some light has changed since the last call.
+	 */
+	void markChanged() {changed = true;};
+	int getNUploads() {return nUploads;};
+	/* GPU sources hold coeffts which never leave the GPU. They are added onto 
+	 *   the block (see SHReduction::addTo()) each time it is uploaded. 
+	 * Call markChanged() when a source's coeffts change.
+	 */
+	void addGPUSource(SHReduction* source);
+	void removeGPUSource(SHReduction* source);
 private:
+	void upload(const SHBlock& block);
 	std::set<SHLight*> lights;
+	std::set<SHReduction*> gpuSources;
 	SHBlock block;
 	GLuint block_ubo;
+	bool changed;
+	int nUploads;
 };
 
 #endif
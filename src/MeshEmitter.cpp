@@ -0,0 +1,152 @@
+#include "MeshEmitter.hpp"
+
+#include "Mesh.hpp"
+#include "Exception.hpp"
+
+#include <SOIL.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	float brightness(const unsigned char* image, int width, int height, const glm::vec2& uv)
+	{
+		// Images are stored upside down.
+		float u = uv.x - floor(uv.x);
+		float v = uv.y - floor(uv.y);
+		int x = std::min(static_cast<int>(u * width), width - 1);
+		int y = std::min(static_cast<int>((1.0f - v) * height), height - 1);
+		return static_cast<float>(image[x + y*width]) / 255.0f;
+	}
+}
+
+MeshEmitter::MeshEmitter(const MeshData& data, const std::string& emissionTex)
+	:totalArea(0.0f)
+{
+	int nTris = static_cast<int>(data.e.size()) / 3;
+	if(nTris == 0)
+		throw Exception("Cannot emit from a mesh with no triangles.\n");
+
+	unsigned char* emission = nullptr;
+	int width = 0, height = 0, channels = 0;
+	if(emissionTex != "")
+	{
+		if(data.t.size() != data.v.size())
+			throw Exception("Emission texture " + emissionTex + 
+				" given for a mesh with no tex coords.\n");
+		emission = SOIL_load_image(
+			("../textures/" + emissionTex).c_str(),
+			&width, &height, &channels,
+			SOIL_LOAD_L);
+		if(!emission) throw Exception(
+			"Emission texture " + emissionTex + " could not be loaded.\n");
+	}
+
+	bool hasNorms = data.n.size() == data.v.size();
+
+	tris.resize(nTris);
+	std::vector<float> weights(nTris);
+	for(int t = 0; t < nTris; ++t)
+	{
+		int ia = data.e[3*t], ib = data.e[3*t + 1], ic = data.e[3*t + 2];
+		glm::vec3 a(data.v[ia]), b(data.v[ib]), c(data.v[ic]);
+
+		Triangle& tri = tris[t];
+		tri.a = a;
+		tri.ab = b - a;
+		tri.ac = c - a;
+
+		glm::vec3 cross = glm::cross(tri.ab, tri.ac);
+		float crossLen = glm::length(cross);
+		glm::vec3 faceNorm = crossLen > 0.0f ? cross / crossLen : glm::vec3(0.0f, 1.0f, 0.0f);
+		tri.na = hasNorms ? data.n[ia] : faceNorm;
+		tri.nb = hasNorms ? data.n[ib] : faceNorm;
+		tri.nc = hasNorms ? data.n[ic] : faceNorm;
+
+		float area = 0.5f * crossLen;
+		totalArea += area;
+		weights[t] = area;
+
+		if(emission)
+		{
+			const glm::vec2& ta = data.t[ia];
+			const glm::vec2& tb = data.t[ib];
+			const glm::vec2& tc = data.t[ic];
+			weights[t] *= 0.25f * (
+				brightness(emission, width, height, ta) +
+				brightness(emission, width, height, tb) +
+				brightness(emission, width, height, tc) +
+				brightness(emission, width, height, (ta + tb + tc) / 3.0f));
+		}
+	}
+
+	if(emission) SOIL_free_image_data(emission);
+
+	buildAliasTable(weights);
+}
+
+void MeshEmitter::buildAliasTable(const std::vector<float>& weights)
+{
+	// Vose's alias method.
+	int n = static_cast<int>(weights.size());
+	double total = 0.0;
+	for(int i = 0; i < n; ++i)
+		total += weights[i];
+	if(total <= 0.0)
+		throw Exception("MeshEmitter has no emitting area.\n");
+
+	prob.resize(n);
+	alias.resize(n);
+
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+	for(int i = 0; i < n; ++i)
+	{
+		scaled[i] = weights[i] * n / total;
+		if(scaled[i] < 1.0) small.push_back(i);
+		else large.push_back(i);
+	}
+
+	while(!small.empty() && !large.empty())
+	{
+		int s = small.back(); small.pop_back();
+		int l = large.back();
+		prob[s] = static_cast<float>(scaled[s]);
+		alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if(scaled[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// Whatever is left over is (up to rounding) exactly 1.
+	for(auto i = large.begin(); i != large.end(); ++i)
+	{
+		prob[*i] = 1.0f;
+		alias[*i] = *i;
+	}
+	for(auto i = small.begin(); i != small.end(); ++i)
+	{
+		prob[*i] = 1.0f;
+		alias[*i] = *i;
+	}
+}
+
+void MeshEmitter::sample(int column, float coin, float r1, float r2, 
+	glm::vec3& pos, glm::vec3& norm) const
+{
+	// Pick between the column's triangle & its alias.
+	int t = std::max(0, std::min(column, static_cast<int>(tris.size()) - 1));
+	if(coin >= prob[t]) t = alias[t];
+
+	const Triangle& tri = tris[t];
+	float s = sqrt(r1);
+	float u = s * (1.0f - r2);
+	float v = s * r2;
+
+	pos = tri.a + u * tri.ab + v * tri.ac;
+	norm = glm::normalize((1.0f - u - v) * tri.na + u * tri.nb + v * tri.nc);
+}
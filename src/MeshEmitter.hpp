@@ -0,0 +1,52 @@
+#ifndef MESHEMITTER_HPP
+#define MESHEMITTER_HPP
+
+#include <glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct MeshData;
+
+/* MeshEmitter
+ * Picks random points spread over the surface of a mesh, e.g. to spawn 
+ *   particles from a burning log. Triangles are chosen in proportion to 
+ *   their area, using an alias table so each pick is O(1) however large 
+ *   the mesh, then a point is picked uniformly within the triangle.
+ * If emissionTex is given, each triangle's area is also weighted by the 
+ *   average brightness of the texture over it (at its corners & centre), 
+ *   so particles can come from only the glowing parts of a mesh. The mesh
+ *   must then have tex coords.
+ * Points & normals are in the mesh's model space.
+ */
+class MeshEmitter
+{
+public:
+	MeshEmitter(const MeshData& data, const std::string& emissionTex = "");
+
+	/* Finds a point & its normal. column should be a uniform random integer
+	 *   in [0, getNTriangles()), and coin, r1 & r2 independent uniform
+	 *   random numbers in [0, 1). column must come from a generator with 
+	 *   enough range for the mesh (rand() gives as few as 15 bits).
+	 */
+	void sample(int column, float coin, float r1, float r2, 
+		glm::vec3& pos, glm::vec3& norm) const;
+
+	int getNTriangles() const {return static_cast<int>(tris.size());};
+	float getTotalArea() const {return totalArea;};
+private:
+	struct Triangle
+	{
+		glm::vec3 a, ab, ac; // Corner a & its two edges.
+		glm::vec3 na, nb, nc;
+	};
+
+	void buildAliasTable(const std::vector<float>& weights);
+
+	std::vector<Triangle> tris;
+	std::vector<float> prob; // Chance of keeping each column of the table.
+	std::vector<int> alias;  // Triangle to take instead.
+	float totalArea;
+};
+
+#endif
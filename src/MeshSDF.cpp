@@ -0,0 +1,349 @@
+#include "MeshSDF.hpp"
+
+#include "Mesh.hpp"
+#include "Intersect.hpp"
+#include "Exception.hpp"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	const char sdfMagic[4] = {'M', 'S', 'D', 'F'};
+	const int bakeBand = 1; // Cells around each triangle given exact distances.
+
+	/* Edge function of (py, pz) against edge u->v in the yz plane.
+	 * Always evaluated in the same vertex order, so the two triangles sharing
+	 *   an edge get exactly opposite values.
+	 */
+	float edgeFunction(const glm::vec3& u, const glm::vec3& v, float py, float pz)
+	{
+		if(u.y < v.y || (u.y == v.y && u.z < v.z))
+			return (v.y - u.y) * (pz - u.z) - (v.z - u.z) * (py - u.y);
+		else
+			return -((u.y - v.y) * (pz - v.z) - (u.z - v.z) * (py - v.y));
+	}
+
+	/* Points exactly on an edge belong to just one of the triangles sharing it
+	 *   (the "top-left" rule), so rays along edges are not counted twice.
+	 */
+	bool ownsEdge(const glm::vec3& u, const glm::vec3& v)
+	{
+		return (v.z - u.z) < 0.0f || ((v.z - u.z) == 0.0f && (v.y - u.y) > 0.0f);
+	}
+
+	bool edgeInside(float w, const glm::vec3& u, const glm::vec3& v)
+	{
+		return w > 0.0f || (w == 0.0f && ownsEdge(u, v));
+	}
+}
+
+MeshSDF::MeshSDF(const MeshData& data, int resolution, float padding)
+{
+	if(data.e.size() < 3)
+		throw Exception("Cannot build an SDF of a mesh with no triangles.\n");
+	if(resolution < 2)
+		throw Exception("SDF resolution must be at least 2.\n");
+
+	std::vector<glm::vec3> verts(data.v.size());
+	glm::vec3 lo( FLT_MAX), hi(-FLT_MAX);
+	for(size_t i = 0; i < data.v.size(); ++i)
+	{
+		verts[i] = glm::vec3(data.v[i].x, data.v[i].y, data.v[i].z);
+		lo = glm::min(lo, verts[i]);
+		hi = glm::max(hi, verts[i]);
+	}
+	std::vector<int> tris(data.e.begin(), data.e.end());
+	int nTris = static_cast<int>(tris.size()) / 3;
+
+	glm::vec3 size = hi - lo;
+	float largest = std::max(size.x, std::max(size.y, size.z));
+	glm::vec3 full = size + glm::vec3(2.0f * padding * largest);
+	boxMin = lo - glm::vec3(padding * largest);
+	cellSize = std::max(full.x, std::max(full.y, full.z)) / (resolution - 1);
+	nx = static_cast<int>(ceil(full.x / cellSize)) + 1;
+	ny = static_cast<int>(ceil(full.y / cellSize)) + 1;
+	nz = static_cast<int>(ceil(full.z / cellSize)) + 1;
+	int nPoints = nx * ny * nz;
+
+	std::cout << "Baking SDF (" << nx << "x" << ny << "x" << nz << ")..." << std::endl;
+
+	// Find the z slices near each triangle, so slices can be filled in parallel.
+	std::vector<std::vector<int>> sliceTris(nz);
+	for(int t = 0; t < nTris; ++t)
+	{
+		const glm::vec3& a = verts[tris[3*t]];
+		const glm::vec3& b = verts[tris[3*t+1]];
+		const glm::vec3& c = verts[tris[3*t+2]];
+		float zMin = std::min(a.z, std::min(b.z, c.z));
+		float zMax = std::max(a.z, std::max(b.z, c.z));
+		int z0 = std::max(0, static_cast<int>(floor((zMin - boxMin.z) / cellSize)) - bakeBand);
+		int z1 = std::min(nz-1, static_cast<int>(ceil((zMax - boxMin.z) / cellSize)) + bakeBand);
+		for(int z = z0; z <= z1; ++z)
+			sliceTris[z].push_back(t);
+	}
+
+	// Exact distances near the surface.
+	std::vector<float> dist(nPoints, FLT_MAX);
+	std::vector<int> closest(nPoints, -1);
+
+	#pragma omp parallel for
+	for(int z = 0; z < nz; ++z)
+		for(auto t = sliceTris[z].begin(); t != sliceTris[z].end(); ++t)
+		{
+			const glm::vec3& a = verts[tris[3 * *t]];
+			const glm::vec3& b = verts[tris[3 * *t + 1]];
+			const glm::vec3& c = verts[tris[3 * *t + 2]];
+			glm::vec3 tMin = (glm::min(a, glm::min(b, c)) - boxMin) / cellSize;
+			glm::vec3 tMax = (glm::max(a, glm::max(b, c)) - boxMin) / cellSize;
+			int x0 = std::max(0, static_cast<int>(floor(tMin.x)) - bakeBand);
+			int x1 = std::min(nx-1, static_cast<int>(ceil(tMax.x)) + bakeBand);
+			int y0 = std::max(0, static_cast<int>(floor(tMin.y)) - bakeBand);
+			int y1 = std::min(ny-1, static_cast<int>(ceil(tMax.y)) + bakeBand);
+
+			for(int y = y0; y <= y1; ++y)
+				for(int x = x0; x <= x1; ++x)
+				{
+					glm::vec3 p = boxMin + cellSize * glm::vec3(
+						static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+					float d = glm::length(p - closestPointOnTriangle(p, a, b, c));
+					int i = index(x, y, z);
+					if(d < dist[i])
+					{
+						dist[i] = d;
+						closest[i] = *t;
+					}
+				}
+		}
+
+	// Sweep closest triangles out to the rest of the grid.
+	for(int round = 0; round < 2; ++round)
+		for(int axis = 0; axis < 3; ++axis)
+			sweep(axis, verts, tris, dist, closest);
+
+	// Count crossings of rays cast along +x to find which points are inside.
+	std::vector<int> crossings(nPoints, 0);
+
+	#pragma omp parallel for
+	for(int z = 0; z < nz; ++z)
+	{
+		float pz = boxMin.z + z * cellSize;
+		for(auto t = sliceTris[z].begin(); t != sliceTris[z].end(); ++t)
+		{
+			const glm::vec3& a = verts[tris[3 * *t]];
+			const glm::vec3& b = verts[tris[3 * *t + 1]];
+			const glm::vec3& c = verts[tris[3 * *t + 2]];
+			float det = edgeFunction(a, b, c.y, c.z);
+			if(det == 0.0f) continue; // Parallel to the rays.
+			// Wind every triangle anticlockwise in the yz plane.
+			const glm::vec3& b1 = det > 0.0f ? b : c;
+			const glm::vec3& c1 = det > 0.0f ? c : b;
+
+			float yMin = std::min(a.y, std::min(b.y, c.y));
+			float yMax = std::max(a.y, std::max(b.y, c.y));
+			int y0 = std::max(0, static_cast<int>(ceil((yMin - boxMin.y) / cellSize)));
+			int y1 = std::min(ny-1, static_cast<int>(floor((yMax - boxMin.y) / cellSize)));
+
+			for(int y = y0; y <= y1; ++y)
+			{
+				float py = boxMin.y + y * cellSize;
+				float wa = edgeFunction(b1, c1, py, pz);
+				float wb = edgeFunction(c1, a,  py, pz);
+				float wc = edgeFunction(a,  b1, py, pz);
+				if(!edgeInside(wa, b1, c1) || !edgeInside(wb, c1, a) || !edgeInside(wc, a, b1))
+					continue;
+
+				float sum = wa + wb + wc;
+				float hitX = (wa * a.x + wb * b1.x + wc * c1.x) / sum;
+				int x = std::max(0, static_cast<int>(ceil((hitX - boxMin.x) / cellSize)));
+				if(x < nx) ++crossings[index(x, y, z)];
+			}
+		}
+	}
+
+	#pragma omp parallel for
+	for(int z = 0; z < nz; ++z)
+		for(int y = 0; y < ny; ++y)
+		{
+			int count = 0;
+			for(int x = 0; x < nx; ++x)
+			{
+				int i = index(x, y, z);
+				count += crossings[i];
+				if(count % 2) dist[i] = -dist[i];
+			}
+		}
+
+	// Quantize.
+	float maxDist = 0.0f;
+	for(int i = 0; i < nPoints; ++i)
+		maxDist = std::max(maxDist, std::fabs(dist[i]));
+	distScale = maxDist > 0.0f ? maxDist / 32767.0f : 1.0f;
+
+	values.resize(nPoints);
+	for(int i = 0; i < nPoints; ++i)
+		values[i] = static_cast<short>(floor(dist[i] / distScale + 0.5f));
+}
+
+void MeshSDF::sweep(int axis, 
+	const std::vector<glm::vec3>& verts, const std::vector<int>& tris,
+	std::vector<float>& dist, std::vector<int>& closest) const
+{
+	const int n[3] = {nx, ny, nz};
+	const int stride[3] = {1, nx, nx * ny};
+	const int u = (axis + 1) % 3;
+	const int v = (axis + 2) % 3;
+	const int nLines = n[u] * n[v];
+
+	#pragma omp parallel for
+	for(int line = 0; line < nLines; ++line)
+	{
+		int cu = line % n[u], cv = line / n[u];
+		int start = cu * stride[u] + cv * stride[v];
+		glm::vec3 base = boxMin;
+		base[u] += cu * cellSize;
+		base[v] += cv * cellSize;
+
+		// Forwards, then backwards.
+		for(int dir = 1; dir >= -1; dir -= 2)
+			for(int step = 1; step < n[axis]; ++step)
+			{
+				int k = dir > 0 ? step : n[axis] - 1 - step;
+				int i = start + k * stride[axis];
+				int t = closest[i - dir * stride[axis]];
+				if(t < 0 || t == closest[i]) continue;
+
+				glm::vec3 p = base;
+				p[axis] += k * cellSize;
+				float d = glm::length(p - closestPointOnTriangle(p,
+					verts[tris[3*t]], verts[tris[3*t+1]], verts[tris[3*t+2]]));
+				if(d < dist[i])
+				{
+					dist[i] = d;
+					closest[i] = t;
+				}
+			}
+	}
+}
+
+MeshSDF::MeshSDF(const std::string& filename)
+{
+	std::string fullPath = "../models/" + filename;
+	std::ifstream file(fullPath, std::ios::binary);
+
+	if(!file) throw Exception(
+		"SDF file " + fullPath + " could not be found.\n");
+
+	char magic[4];
+	file.read(magic, 4);
+	file.read(reinterpret_cast<char*>(&nx), sizeof(int));
+	file.read(reinterpret_cast<char*>(&ny), sizeof(int));
+	file.read(reinterpret_cast<char*>(&nz), sizeof(int));
+	file.read(reinterpret_cast<char*>(&boxMin[0]), 3 * sizeof(float));
+	file.read(reinterpret_cast<char*>(&cellSize), sizeof(float));
+	file.read(reinterpret_cast<char*>(&distScale), sizeof(float));
+
+	if(!file || !std::equal(magic, magic + 4, sdfMagic) || nx < 2 || ny < 2 || nz < 2)
+		throw Exception("File " + fullPath + " is not a valid SDF.\n");
+
+	values.resize(nx * ny * nz);
+	file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(short));
+
+	if(!file) throw Exception("SDF " + fullPath + " is truncated.\n");
+
+	file.close();
+}
+
+MeshSDF* MeshSDF::load(
+	const std::string& meshFilename,
+	const std::string& sdfFilename,
+	int resolution)
+{
+	if(!fileExists("../models/" + sdfFilename))
+		bake(meshFilename, sdfFilename, resolution);
+	return new MeshSDF(sdfFilename);
+}
+
+void MeshSDF::bake(
+	const std::string& meshFilename,
+	const std::string& sdfFilename,
+	int resolution)
+{
+	MeshSDF sdf(Mesh::loadSceneFile(meshFilename), resolution);
+	sdf.write(sdfFilename);
+}
+
+void MeshSDF::write(const std::string& filename) const
+{
+	std::string fullPath = "../models/" + filename;
+	std::ofstream file(fullPath, std::ios::binary);
+
+	if(!file) throw Exception("Could not open " + fullPath + " for writing.\n");
+
+	file.write(sdfMagic, 4);
+	file.write(reinterpret_cast<const char*>(&nx), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&ny), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&nz), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&boxMin[0]), 3 * sizeof(float));
+	file.write(reinterpret_cast<const char*>(&cellSize), sizeof(float));
+	file.write(reinterpret_cast<const char*>(&distScale), sizeof(float));
+	file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(short));
+
+	file.close();
+
+	std::cout << "SDF written to " << fullPath << std::endl;
+}
+
+glm::vec3 MeshSDF::getBoxMax() const
+{
+	return boxMin + cellSize * glm::vec3(
+		static_cast<float>(nx-1), static_cast<float>(ny-1), static_cast<float>(nz-1));
+}
+
+float MeshSDF::gridValue(float gx, float gy, float gz) const
+{
+	int x0 = std::min(static_cast<int>(gx), nx-2);
+	int y0 = std::min(static_cast<int>(gy), ny-2);
+	int z0 = std::min(static_cast<int>(gz), nz-2);
+
+	float tx = gx - x0;
+	float ty = gy - y0;
+	float tz = gz - z0;
+
+	int i = index(x0, y0, z0);
+	int dy = nx, dz = nx * ny;
+
+	float c00 = values[i]         + tx * (values[i + 1]           - values[i]);
+	float c10 = values[i + dy]    + tx * (values[i + dy + 1]      - values[i + dy]);
+	float c01 = values[i + dz]    + tx * (values[i + dz + 1]      - values[i + dz]);
+	float c11 = values[i + dy+dz] + tx * (values[i + dy + dz + 1] - values[i + dy + dz]);
+	float c0 = c00 + ty * (c10 - c00);
+	float c1 = c01 + ty * (c11 - c01);
+	return (c0 + tz * (c1 - c0)) * distScale;
+}
+
+float MeshSDF::distance(const glm::vec3& pos) const
+{
+	glm::vec3 g = (pos - boxMin) / cellSize;
+	glm::vec3 clamped = glm::clamp(g, glm::vec3(0.0f),
+		glm::vec3(static_cast<float>(nx-1), static_cast<float>(ny-1), static_cast<float>(nz-1)));
+
+	return gridValue(clamped.x, clamped.y, clamped.z) + 
+		glm::length(g - clamped) * cellSize;
+}
+
+glm::vec3 MeshSDF::gradient(const glm::vec3& pos) const
+{
+	glm::vec3 dx(cellSize, 0.0f, 0.0f);
+	glm::vec3 dy(0.0f, cellSize, 0.0f);
+	glm::vec3 dz(0.0f, 0.0f, cellSize);
+	return glm::vec3(
+		distance(pos + dx) - distance(pos - dx),
+		distance(pos + dy) - distance(pos - dy),
+		distance(pos + dz) - distance(pos - dz)) / (2.0f * cellSize);
+}
@@ -0,0 +1,60 @@
+#ifndef MESHSDF_HPP
+#define MESHSDF_HPP
+
+#include <glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct MeshData;
+
+/* MeshSDF
+ * A signed distance field of a mesh, negative inside it, sampled on a 
+ *   grid of cubic cells covering the mesh's bounding box plus padding (as a
+ *   fraction of its largest side). Distances are stored as 16 bit integers.
+ * Build one from MeshData, or call load() to read it from ../models/,
+ *   baking & caching it there first if it isn't found. 
+ * Baking finds exact distances to nearby triangles, sweeps the closest
+ *   triangle out along each axis to fill the rest of the grid, then finds
+ *   the sign by counting ray crossings along x. Each pass is parallel over 
+ *   slices or lines of the grid. The mesh should be closed.
+ * distance() & gradient() are O(1), trilinearly interpolating the grid, and
+ *   are in the mesh's model space. Points outside the grid get the distance
+ *   at the nearest grid point plus the distance to it.
+ */
+class MeshSDF
+{
+public:
+	MeshSDF(const MeshData& data, int resolution, float padding = 0.1f);
+	MeshSDF(const std::string& filename);
+
+	static MeshSDF* load(
+		const std::string& meshFilename,
+		const std::string& sdfFilename,
+		int resolution = 64);
+	static void bake(
+		const std::string& meshFilename,
+		const std::string& sdfFilename,
+		int resolution = 64);
+	void write(const std::string& filename) const;
+
+	float distance(const glm::vec3& pos) const;
+	glm::vec3 gradient(const glm::vec3& pos) const;
+
+	const glm::vec3& getBoxMin() const {return boxMin;};
+	glm::vec3 getBoxMax() const;
+private:
+	int index(int x, int y, int z) const {return x + nx*(y + ny*z);};
+	float gridValue(float gx, float gy, float gz) const;
+	void sweep(int axis, 
+		const std::vector<glm::vec3>& verts, const std::vector<int>& tris,
+		std::vector<float>& dist, std::vector<int>& closest) const;
+
+	glm::vec3 boxMin;
+	float cellSize;
+	int nx, ny, nz;
+	float distScale; // Distance per unit of the stored values.
+	std::vector<short> values;
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include "SH.hpp"
 #include "Texture.hpp"
 #include "Exception.hpp"
+#include "Scene.hpp"
+#include "SHProbeVolume.hpp"
+#include "SHMat.hpp"
 
 #include "SOIL.h"
 
@@ -15,7 +18,7 @@
 PRTMesh::PRTMesh(
 	const std::string& bakedFilename,
 	SHShader* shader)
-	:Renderable(false), shader(shader)
+	:Renderable(false), shader(shader), probes(nullptr)
 {
 	std::vector<PRTMeshVertex> mesh;
 	std::vector<GLushort> elems;
@@ -654,6 +657,14 @@ void PRTMesh::render()
 
 	shader->setTexUnit(arrTex->getTexUnit());
 
+	if(probes)
+	{
+		// Probe coeffts are in world space, transfer is in model space.
+		std::vector<glm::vec3> local = probes->sample(glm::vec3(getOrigin()));
+		local = SHMat(glm::inverse(rotation), GC::nSHBands) * local;
+		scene->shManager.uploadWithExtra(local);
+	}
+
 	shader->use();
 
 	glBindVertexArray(vao);
@@ -665,4 +676,6 @@ void PRTMesh::render()
 	glBindVertexArray(0);
 
 	glUseProgram(0);
+
+	if(probes) scene->shManager.updateBlock();
 }
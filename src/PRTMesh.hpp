@@ -12,6 +12,7 @@
 #include "Shader.hpp"
 
 class ArrayTexture;
+class SHProbeVolume;
 
 enum PRTMode : char {UNSHADOWED, SHADOWED, INTERREFLECTED};
 
@@ -50,6 +51,11 @@ public:
 	void render();
 	void update(int dTime) {};
 	Shader* getShader() {return static_cast<Shader*>(shader);};
+
+	/* If set, the mesh is lit by the probe volume sampled at its origin, 
+	 *   in addition to the scene's SH lights. Set to nullptr to disable.
+	 */
+	void setProbeVolume(SHProbeVolume* probes) {this->probes = probes;};
 private:
 	static std::string genExt(PRTMode mode, int nBands);
 
@@ -97,6 +103,7 @@ private:
 	size_t numElems;
 
 	ArrayTexture* arrTex;
+	SHProbeVolume* probes;
 
 	GLuint vao;
 	GLuint v_vbo;
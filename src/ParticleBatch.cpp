@@ -0,0 +1,209 @@
+#include "ParticleBatch.hpp"
+
+#include "Particles.hpp"
+#include "Shader.hpp"
+#include "StreamBuffer.hpp"
+#include "Texture.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+ParticleBatch::ParticleBatch(ParticleBatchShader* shader, 
+	Texture* bbTex, Texture* decayTex, bool additive)
+	:Renderable(true), shader(shader), bbTex(bbTex), decayTex(decayTex),
+	 additive(additive), nParticles(0), stream(nullptr), mapped(nullptr), 
+	 emitterIndex_vbo(0)
+{
+	shader->setBBTexUnit(bbTex->getTexUnit());
+	shader->setDecayTexUnit(decayTex->getTexUnit());
+
+	pos_attrib = shader->getAttribLoc("vPos");
+	decay_attrib = shader->getAttribLoc("vDecay");
+	randTex_attrib = shader->getAttribLoc("vRandTex");
+	emitter_attrib = shader->getAttribLoc("vEmitter");
+
+	glGenBuffers(1, &block_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, block_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, GC::maxBatchEmitters * sizeof(EmitterParams),
+		nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenVertexArrays(1, &vao);
+}
+
+ParticleBatch::~ParticleBatch()
+{
+	for(auto i = emitters.begin(); i != emitters.end(); ++i)
+		(*i)->batch = nullptr;
+	if(mapped) stream->unmap();
+	delete stream;
+	glDeleteBuffers(1, &emitterIndex_vbo);
+	glDeleteBuffers(1, &block_ubo);
+	glDeleteVertexArrays(1, &vao);
+}
+
+void ParticleBatch::add(AdvectParticles* emitter)
+{
+	if(emitter->batch)
+		throw Exception("Emitter is already in a ParticleBatch.\n");
+	if(getNEmitters() >= GC::maxBatchEmitters)
+		throw Exception("ParticleBatch is full, see GC::maxBatchEmitters.\n");
+
+	emitter->batch = this;
+	emitters.push_back(emitter);
+	rebuild();
+}
+
+void ParticleBatch::remove(AdvectParticles* emitter)
+{
+	auto i = std::find(emitters.begin(), emitters.end(), emitter);
+	if(i == emitters.end()) return;
+
+	emitter->batch = nullptr;
+	emitters.erase(i);
+	rebuild();
+}
+
+Shader* ParticleBatch::getShader()
+{
+	return static_cast<Shader*>(shader);
+}
+
+PackedAdvectParticle* ParticleBatch::getSlice(const AdvectParticles* emitter)
+{
+	auto i = std::find(emitters.begin(), emitters.end(), emitter);
+	if(i == emitters.end() || !stream) return nullptr;
+
+	if(!mapped)
+	{
+		mapped = static_cast<PackedAdvectParticle*>(stream->map());
+		std::fill(packed.begin(), packed.end(), false);
+	}
+
+	int e = static_cast<int>(i - emitters.begin());
+	packed[e] = true;
+	return mapped + offsets[e];
+}
+
+void ParticleBatch::rebuild()
+{
+	nParticles = 0;
+	offsets.clear();
+	for(auto e = emitters.begin(); e != emitters.end(); ++e)
+	{
+		offsets.push_back(nParticles);
+		nParticles += static_cast<int>((*e)->getParticles().size());
+	}
+	params.resize(emitters.size());
+	packed.assign(emitters.size(), false);
+	firsts.resize(emitters.size());
+	// Nothing is drawn for an emitter until it has packed into the stream.
+	counts.assign(emitters.size(), 0);
+
+	if(mapped) stream->unmap();
+	mapped = nullptr;
+	delete stream;
+	stream = nullptr;
+	if(nParticles == 0) return;
+	stream = new StreamBuffer(nParticles * sizeof(PackedAdvectParticle));
+
+	// Emitter indices are repeated for every region of the stream, so the
+	//   same draw offset can be used for both buffers.
+	std::vector<GLint> indices;
+	indices.reserve(nParticles * GC::nStreamRegions);
+	for(int region = 0; region < GC::nStreamRegions; ++region)
+		for(int e = 0; e < getNEmitters(); ++e)
+			indices.insert(indices.end(), emitters[e]->getParticles().size(), e);
+
+	if(!emitterIndex_vbo) glGenBuffers(1, &emitterIndex_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, emitterIndex_vbo);
+	glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLint), 
+		indices.data(), GL_STATIC_DRAW);
+
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, stream->getBuffer());
+	glEnableVertexAttribArray(pos_attrib);
+	glEnableVertexAttribArray(decay_attrib);
+	glEnableVertexAttribArray(randTex_attrib);
+	glVertexAttribPointer(pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedAdvectParticle),
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, pos)));
+	glVertexAttribPointer(decay_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, decay)));
+	glVertexAttribPointer(randTex_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, randTex)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, emitterIndex_vbo);
+	glEnableVertexAttribArray(emitter_attrib);
+	glVertexAttribIPointer(emitter_attrib, 1, GL_INT, sizeof(GLint), 0);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleBatch::render()
+{
+	if(!scene || !stream) return;
+
+	std::chrono::high_resolution_clock::time_point start = 
+		std::chrono::high_resolution_clock::now();
+
+	// If no emitter packed this frame, the last frame's region is drawn again.
+	if(mapped)
+	{
+		stream->unmap();
+		mapped = nullptr;
+		for(int e = 0; e < getNEmitters(); ++e)
+			counts[e] = packed[e] ? emitters[e]->getNActive() : 0;
+	}
+
+	GLint first = stream->getFirst(sizeof(PackedAdvectParticle));
+	int nDrawn = 0;
+	for(int e = 0; e < getNEmitters(); ++e)
+	{
+		AdvectParticles* emitter = emitters[e];
+		params[e].modelToWorld = emitter->getPackToWorld();
+		params[e].bbSizeAlpha = glm::vec4(
+			emitter->bbWidth * emitter->getDrawBBScale(), 
+			emitter->bbHeight * emitter->getDrawBBScale(), 
+			emitter->getDrawAlpha(), 0.0f);
+		firsts[e] = first + offsets[e];
+		nDrawn += counts[e];
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, block_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, params.size() * sizeof(EmitterParams), 
+		params.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 
+		Shader::getUBlockBindingIndex("emitterBlock"), block_ubo);
+
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND); 
+	if(additive)
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// The shader may be shared with batches using other textures.
+	shader->setBBTexUnit(bbTex->getTexUnit());
+	shader->setDecayTexUnit(decayTex->getTexUnit());
+
+	shader->use();
+	glBindVertexArray(vao);
+
+	glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), getNEmitters());
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+
+	// Share the time out, so frameBudget sees each emitter's cost.
+	float renderTime = std::chrono::duration<float, std::milli>(
+		std::chrono::high_resolution_clock::now() - start).count();
+	for(int e = 0; e < getNEmitters(); ++e)
+		emitters[e]->setBatchRenderTime(nDrawn > 0 ? 
+			renderTime * counts[e] / static_cast<float>(nDrawn) : 0.0f);
+}
@@ -0,0 +1,84 @@
+#ifndef PARTICLEBATCH_HPP
+#define PARTICLEBATCH_HPP
+
+#include "Renderable.hpp"
+#include "GC.hpp"
+
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include <vector>
+
+class AdvectParticles;
+struct PackedAdvectParticle;
+class ParticleBatchShader;
+class StreamBuffer;
+class Texture;
+
+/* ParticleBatch
+ * Renders a number of AdvectParticles emitters with a single draw call.
+ * Every emitter in a batch shares the batch's shader, textures & blending,
+ *   but keeps its own modelToWorld, bbWidth, bbHeight & alpha, which are
+ *   written to the emitterBlock uniform block each frame. Each emitter 
+ *   packs its particles straight into its own slice of one StreamBuffer, 
+ *   alongside an emitter index for each particle, & its modelToWorld also
+ *   unpacks their positions. Only active particles are drawn.
+ * Emitters should still be added to the scene so that they are updated,
+ *   but they do not render themselves while in a batch. Each is given its
+ *   share of the batch's render time, in proportion to its active particles.
+ * At most GC::maxBatchEmitters emitters may be added to a batch.
+ */
+class ParticleBatch : public Renderable
+{
+public:
+	ParticleBatch(ParticleBatchShader* shader, 
+		Texture* bbTex, Texture* decayTex, bool additive = true);
+	~ParticleBatch();
+
+	void add(AdvectParticles* emitter);
+	void remove(AdvectParticles* emitter);
+	int getNEmitters() const {return static_cast<int>(emitters.size());};
+	/* Returns where emitter should pack its particles this frame. The 
+	 *   stream is mapped when the first emitter asks each frame, & unmapped
+	 *   by render(). Returns nullptr if emitter isn't in the batch.
+	 */
+	PackedAdvectParticle* getSlice(const AdvectParticles* emitter);
+
+	void update(int /*dTime*/) {};
+	void render();
+	Shader* getShader();
+private:
+	// Matches Emitter in emitterBlock (std140).
+	struct EmitterParams
+	{
+		glm::mat4 modelToWorld;
+		glm::vec4 bbSizeAlpha;
+	};
+
+	void rebuild();
+
+	ParticleBatchShader* shader;
+	Texture* bbTex;
+	Texture* decayTex;
+	bool additive;
+
+	std::vector<AdvectParticles*> emitters;
+	std::vector<EmitterParams> params;
+	int nParticles;
+	std::vector<int> offsets; // First particle of each emitter in a region.
+	std::vector<bool> packed; // Whether each emitter has packed this frame.
+	std::vector<GLint> firsts; // Draw ranges of each emitter.
+	std::vector<GLsizei> counts;
+
+	StreamBuffer* stream;
+	PackedAdvectParticle* mapped; // Current region, if mapped this frame.
+	GLuint emitterIndex_vbo;
+	GLuint block_ubo;
+	GLuint vao;
+	GLuint pos_attrib;
+	GLuint decay_attrib;
+	GLuint randTex_attrib;
+	GLuint emitter_attrib;
+};
+
+#endif
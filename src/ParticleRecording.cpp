@@ -0,0 +1,205 @@
+#include "ParticleRecording.hpp"
+
+#include "Particles.hpp"
+#include "Exception.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	const char recordingMagic[4] = {'P', 'R', 'E', 'C'};
+	const int recordingVersion = 1;
+
+	struct FrameHeader
+	{
+		int dTime;
+		int nActive;
+		float boxMin[3];
+		float boxStep[3]; // Distance per unit of the quantized positions.
+	};
+
+	struct PackedParticle
+	{
+		unsigned short x, y, z;
+		unsigned char decay;
+		unsigned char randTex;
+	};
+
+	template<typename T>
+	void append(std::vector<unsigned char>& buffer, const T* data, size_t count)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+	}
+
+	unsigned char quantize8(float value)
+	{
+		return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+ParticleRecorder::ParticleRecorder(const std::string& filename, int maxParticles, int framesPerChunk)
+	:chunkFrames(0), framesPerChunk(std::max(1, framesPerChunk)),
+	 maxParticles(maxParticles), nFrames(0)
+{
+	std::string fullPath = "../models/" + filename;
+	file.open(fullPath, std::ios::binary);
+
+	if(!file) throw Exception("Could not open " + fullPath + " for writing.\n");
+
+	file.write(recordingMagic, 4);
+	file.write(reinterpret_cast<const char*>(&recordingVersion), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&maxParticles), sizeof(int));
+}
+
+ParticleRecorder::~ParticleRecorder()
+{
+	flushChunk();
+	file.close();
+	std::cout << "Recorded " << nFrames << " frames of particles." << std::endl;
+}
+
+void ParticleRecorder::addFrame(int dTime, const AdvectParticle* particles, int nActive)
+{
+	nActive = std::min(nActive, maxParticles);
+
+	FrameHeader header;
+	header.dTime = dTime;
+	header.nActive = nActive;
+
+	float lo[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+	float hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for(int i = 0; i < nActive; ++i)
+		for(int a = 0; a < 3; ++a)
+		{
+			lo[a] = std::min(lo[a], particles[i].pos[a]);
+			hi[a] = std::max(hi[a], particles[i].pos[a]);
+		}
+	for(int a = 0; a < 3; ++a)
+	{
+		header.boxMin[a] = nActive > 0 ? lo[a] : 0.0f;
+		header.boxStep[a] = nActive > 0 && hi[a] > lo[a] ? (hi[a] - lo[a]) / 65535.0f : 1.0f;
+	}
+
+	std::vector<PackedParticle> packed(nActive);
+	for(int i = 0; i < nActive; ++i)
+	{
+		unsigned short* q[3] = {&packed[i].x, &packed[i].y, &packed[i].z};
+		for(int a = 0; a < 3; ++a)
+			*q[a] = static_cast<unsigned short>(
+				(particles[i].pos[a] - header.boxMin[a]) / header.boxStep[a] + 0.5f);
+		packed[i].decay = quantize8(particles[i].decay);
+		packed[i].randTex = quantize8(particles[i].randTex);
+	}
+
+	append(chunk, &header, 1);
+	if(nActive > 0) append(chunk, packed.data(), packed.size());
+	++chunkFrames;
+	++nFrames;
+
+	if(chunkFrames >= framesPerChunk) flushChunk();
+}
+
+void ParticleRecorder::flushChunk()
+{
+	if(chunkFrames == 0) return;
+
+	int nBytes = static_cast<int>(chunk.size());
+	file.write(reinterpret_cast<const char*>(&chunkFrames), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&nBytes), sizeof(int));
+	file.write(reinterpret_cast<const char*>(chunk.data()), nBytes);
+
+	chunk.clear();
+	chunkFrames = 0;
+}
+
+ParticleReplay::ParticleReplay(const std::string& filename, bool loop)
+	:fullPath("../models/" + filename), 
+	 chunkPos(0), chunkFramesLeft(0), loop(loop)
+{
+	file.open(fullPath, std::ios::binary);
+
+	if(!file) throw Exception(
+		"Particle recording " + fullPath + " could not be found.\n");
+
+	char magic[4];
+	int version;
+	file.read(magic, 4);
+	file.read(reinterpret_cast<char*>(&version), sizeof(int));
+	file.read(reinterpret_cast<char*>(&maxParticles), sizeof(int));
+
+	if(!file || !std::equal(magic, magic + 4, recordingMagic))
+		throw Exception("File " + fullPath + " is not a particle recording.\n");
+	if(version != recordingVersion)
+		throw Exception("Particle recording " + fullPath + " has an unknown version.\n");
+
+	firstChunk = file.tellg();
+}
+
+bool ParticleReplay::readChunk()
+{
+	int nFrames = 0, nBytes = 0;
+	file.read(reinterpret_cast<char*>(&nFrames), sizeof(int));
+	file.read(reinterpret_cast<char*>(&nBytes), sizeof(int));
+
+	if(!file && loop)
+	{
+		// Back to the start.
+		file.clear();
+		file.seekg(firstChunk);
+		file.read(reinterpret_cast<char*>(&nFrames), sizeof(int));
+		file.read(reinterpret_cast<char*>(&nBytes), sizeof(int));
+	}
+	if(!file || nFrames <= 0) return false;
+
+	chunk.resize(nBytes);
+	file.read(reinterpret_cast<char*>(chunk.data()), nBytes);
+	if(!file) throw Exception("Particle recording " + fullPath + " is truncated.\n");
+
+	chunkPos = 0;
+	chunkFramesLeft = nFrames;
+	return true;
+}
+
+int ParticleReplay::peekDTime()
+{
+	if(chunkFramesLeft == 0 && !readChunk()) return 0;
+
+	FrameHeader header;
+	memcpy(&header, &chunk[chunkPos], sizeof(FrameHeader));
+	return header.dTime;
+}
+
+bool ParticleReplay::nextFrame(int& dTime, int& nActive, 
+	float* x, float* y, float* z, float* decay, float* randTex)
+{
+	if(chunkFramesLeft == 0 && !readChunk()) return false;
+
+	FrameHeader header;
+	memcpy(&header, &chunk[chunkPos], sizeof(FrameHeader));
+	chunkPos += sizeof(FrameHeader);
+
+	if(header.nActive < 0 || header.nActive > maxParticles ||
+		chunkPos + header.nActive * sizeof(PackedParticle) > chunk.size())
+		throw Exception("Particle recording " + fullPath + " is corrupt.\n");
+
+	const PackedParticle* packed = 
+		reinterpret_cast<const PackedParticle*>(&chunk[chunkPos]);
+	for(int i = 0; i < header.nActive; ++i)
+	{
+		x[i] = header.boxMin[0] + packed[i].x * header.boxStep[0];
+		y[i] = header.boxMin[1] + packed[i].y * header.boxStep[1];
+		z[i] = header.boxMin[2] + packed[i].z * header.boxStep[2];
+		decay[i] = packed[i].decay / 255.0f;
+		randTex[i] = packed[i].randTex / 255.0f;
+	}
+	chunkPos += header.nActive * sizeof(PackedParticle);
+	--chunkFramesLeft;
+
+	dTime = header.dTime;
+	nActive = header.nActive;
+	return true;
+}
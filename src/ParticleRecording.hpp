@@ -0,0 +1,74 @@
+#ifndef PARTICLERECORDING_HPP
+#define PARTICLERECORDING_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct AdvectParticle;
+
+/* ParticleRecorder
+ * Records the particles of an AdvectParticles each frame, along with the 
+ *   frame's dTime, so the exact same input can later be fed to lighting &
+ *   rendering by a ParticleReplay.
+ * Each frame stores its active particles in 8 bytes each: positions
+ *   quantized to 16 bits within the frame's bounding box, and decay &
+ *   randTex to 8 bits. Frames are written framesPerChunk at a time, each
+ *   chunk prefixed with its frame count & size in bytes, so files can be
+ *   read back a chunk at a time however long the capture.
+ * Recordings are stored in ../models/ alongside the other baked files.
+ * The file is completed when the recorder is destroyed.
+ */
+class ParticleRecorder
+{
+public:
+	ParticleRecorder(const std::string& filename, int maxParticles, int framesPerChunk = 64);
+	~ParticleRecorder();
+
+	void addFrame(int dTime, const AdvectParticle* particles, int nActive);
+	int getNFrames() const {return nFrames;};
+private:
+	void flushChunk();
+
+	std::ofstream file;
+	std::vector<unsigned char> chunk;
+	int chunkFrames;
+	int framesPerChunk;
+	int maxParticles;
+	int nFrames;
+};
+
+/* ParticleReplay
+ * Plays back a file written by ParticleRecorder, one frame at a time. 
+ *   Set AdvectParticles::replay to drive an emitter (or any of its derived
+ *   lighting classes) from the file instead of simulating.
+ * If loop is set, playback restarts at the end of the file, otherwise the
+ *   last frame is held.
+ */
+class ParticleReplay
+{
+public:
+	ParticleReplay(const std::string& filename, bool loop = true);
+
+	int getMaxParticles() const {return maxParticles;};
+	// dTime recorded with the next frame, to step the rest of the scene by.
+	int peekDTime();
+	/* Decodes the next frame into arrays of at least getMaxParticles() 
+	 *   floats. Returns false if there are no frames left.
+	 */
+	bool nextFrame(int& dTime, int& nActive, 
+		float* x, float* y, float* z, float* decay, float* randTex);
+private:
+	bool readChunk();
+
+	std::string fullPath;
+	std::ifstream file;
+	std::streampos firstChunk;
+	std::vector<unsigned char> chunk;
+	size_t chunkPos;
+	int chunkFramesLeft;
+	int maxParticles;
+	bool loop;
+};
+
+#endif
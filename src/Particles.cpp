@@ -2,18 +2,38 @@
 
 #include "Texture.hpp"
 #include "Scene.hpp"
+#include "Camera.hpp"
 #include "SphereFunc.hpp"
 #include "Shader.hpp"
+#include "SHProbeVolume.hpp"
+#include "SHReduction.hpp"
+#include "CubemapSplatter.hpp"
+#include "StreamBuffer.hpp"
+#include "ForceField.hpp"
+#include "FluidSolver.hpp"
+#include "MeshSDF.hpp"
+#include "MeshEmitter.hpp"
+#include "ParticleRecording.hpp"
+#include "ParticleBatch.hpp"
+#include "Exception.hpp"
 
 #include <SOIL.h>
 #include <GL/glut.h>
 
 #include <gtc/matrix_transform.hpp>
 
+#include <omp.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include<algorithm>
+#include <chrono>
+#include <limits>
 
 const float AdvectParticlesLights::minColor = 0.6f;
 const float AdvectParticlesSHLights::minColor = 0.7f;
+const float AdvectParticlesSHProbes::minColor = 0.7f;
 const glm::mat4 AdvectParticlesSHCubemap::turnAround = 
 	glm::rotate(glm::mat4(1.0f), 180.0f, glm::vec3(0.0f, 1.0f, 0.0f));
 
@@ -21,46 +41,81 @@ AdvectParticles::AdvectParticles(int maxParticles,
 	ParticleShader* shader, 
 	Texture* bbTex, Texture* decayTex, bool texScrolls, bool additive)
 	:ParticleSystem(maxParticles, shader),
-	 bbTex(bbTex), decayTex(decayTex),
+	 batch(nullptr), extForce(glm::vec4(0.0f)), forceField(nullptr),
+	 fluid(nullptr), fluidDrag(0.005f), emitter(nullptr),
+	 recorder(nullptr), replay(nullptr),
 	 avgLifetime(3000), varLifetime(200),
-	 avgPerturbTime(1000), varPerturbTime(100),
 	 initAcn(glm::vec4(0.0, 0.0000004, 0.0, 0.0)),
 	 initVel(0.001f),
 	 initUpVel(0.0f),
+	 avgPerturbTime(1000), varPerturbTime(100),
 	 perturbRadius(0.0001f),
-	 centerForce(6e-7f),
 	 baseRadius(0.2f),
-	 bbHeight(0.3f), bbWidth(0.3f),
-	 extForce(glm::vec4(0.0f)),
-	 perturbOn(true), initPerturb(false),
+	 centerForce(6e-7f),
 	 cameraDir(glm::vec3(0.0, 0.0, -1.0)),
-	 additive(additive), height(initAcn.y * avgLifetime)
-{init(bbTex, decayTex, texScrolls);}
+	 bbHeight(0.3f), bbWidth(0.3f),
+	 simStep(10), maxSubsteps(10), interpolate(true),
+	 frameBudget(0.0f), minParticles(maxParticles / 8),
+	 lodSize(0.0f), lodRadius(0.5f), lodMaxStepScale(4),
+	 additive(additive),
+	 bbTex(bbTex), decayTex(decayTex),
+	 statWeightByDecay(false), clusterLights(false),
+	 perturbOn(true), initPerturb(false), accumulator(0),
+	 updateTime(0.0f), renderTime(0.0f), avgCost(-1.0f), lodStepScale(1)
+{
+	// height is declared before the members it depends on.
+	height = initAcn.y * avgLifetime;
+	init(bbTex, decayTex, texScrolls);
+}
+
+AdvectParticles::~AdvectParticles()
+{
+	if(batch) batch->remove(this);
+	delete particleStream;
+	glDeleteVertexArrays(1, &vao);
+}
 
 void AdvectParticles::init(Texture* bbTex, Texture* decayTex, bool texScrolls)
 {
 	shader->use();
 
 	// Set up particles.
+	particles.resize(maxParticles);
+	posX.resize(maxParticles); posY.resize(maxParticles); posZ.resize(maxParticles);
+	prevX.resize(maxParticles); prevY.resize(maxParticles); prevZ.resize(maxParticles);
+	velX.resize(maxParticles); velY.resize(maxParticles); velZ.resize(maxParticles);
+	acnX.resize(maxParticles); acnY.resize(maxParticles); acnZ.resize(maxParticles);
+	decay.resize(maxParticles);
+	randTex.resize(maxParticles);
+	time.resize(maxParticles);
+	lifeTime.resize(maxParticles);
+	perturbCounter.resize(maxParticles);
+	perturbTime.resize(maxParticles);
+	seedSpawnRNGs();
+
 	for(int i = 0; i < maxParticles; ++i)
 	{
-		AdvectParticle p;
-		p.pos = randInitPos();
-		p.decay = 0.0f;
-		p.randTex = randf(0.0f, 1.0f);
-		particles.push_back(p);
+		glm::vec4 outward;
+		glm::vec4 pos = randInitPos(outward);
+		posX[i] = prevX[i] = pos.x; posY[i] = prevY[i] = pos.y; posZ[i] = prevZ[i] = pos.z;
+		decay[i] = 0.0f;
+		randTex[i] = randf(0.0f, 1.0f);
 
-		time.push_back(0);
+		time[i] = 0;
 		// Evenly spacing lifetimes so system stabilises quicly.
-		lifeTime.push_back((avgLifetime * i) / maxParticles);
-		acn.push_back(initAcn);
+		lifeTime[i] = (avgLifetime * i) / maxParticles;
+		acnX[i] = initAcn.x; acnY[i] = initAcn.y; acnZ[i] = initAcn.z;
 		
-		perturbCounter.push_back(0);
-		perturbTime.push_back(avgPerturbTime + randi(-varPerturbTime, varPerturbTime)); 
+		perturbCounter[i] = 0;
+		perturbTime[i] = avgPerturbTime + randi(-varPerturbTime, varPerturbTime); 
 
-		if(initPerturb) vel.push_back(perturb(getInitVel(p.pos)));
-		else vel.push_back(getInitVel(p.pos));
+		glm::vec4 vel = initPerturb ? perturb(getInitVel(outward)) : getInitVel(outward);
+		velX[i] = vel.x; velY[i] = vel.y; velZ[i] = vel.z;
 	}
+	particleStream = new StreamBuffer(maxParticles * sizeof(PackedAdvectParticle));
+	particles_vbo = particleStream->getBuffer();
+	nActive = maxParticles;
+	packAll(1.0f);
 
 	glUseProgram(0);
 
@@ -68,12 +123,6 @@ void AdvectParticles::init(Texture* bbTex, Texture* decayTex, bool texScrolls)
 	shader->setBBTexUnit(bbTex->getTexUnit());
 	shader->setDecayTexUnit(decayTex->getTexUnit());
 
-	// Set up vertex buffer objects.
-	glGenBuffers(1, &particles_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, particles_vbo);
-	glBufferData(GL_ARRAY_BUFFER, particles.size()*sizeof(AdvectParticle),
-		particles.data(), GL_DYNAMIC_DRAW);
-
 	// Set up uniforms.
 	shader->setBBWidth(bbWidth);
 	shader->setBBHeight(bbHeight);
@@ -89,19 +138,22 @@ void AdvectParticles::init(Texture* bbTex, Texture* decayTex, bool texScrolls)
 	glEnableVertexAttribArray(pos_attrib);
 	glEnableVertexAttribArray(decay_attrib);
 	glEnableVertexAttribArray(randTex_attrib);
-	glVertexAttribPointer(pos_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle),
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, pos)));
-	glVertexAttribPointer(decay_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle), 
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, decay)));
-	glVertexAttribPointer(randTex_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle), 
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, randTex)));
+	glVertexAttribPointer(pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedAdvectParticle),
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, pos)));
+	glVertexAttribPointer(decay_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, decay)));
+	glVertexAttribPointer(randTex_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, randTex)));
 
 	glBindVertexArray(0);
 }
 
 void AdvectParticles::render()
 {
-	if(!scene) return;
+	if(!scene || batch) return;
+	std::chrono::high_resolution_clock::time_point start = 
+		std::chrono::high_resolution_clock::now();
+
 	glDepthMask(GL_FALSE);
 	glEnable(GL_BLEND); 
 	if(additive)
@@ -109,30 +161,140 @@ void AdvectParticles::render()
 	else
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	shader->setModelToWorld(modelToWorld);
-	shader->setAlpha(alpha);
+	shader->setModelToWorld(getPackToWorld());
+	shader->setAlpha(getDrawAlpha());
 	shader->setBBTexUnit(bbTex->getTexUnit());
 	shader->setDecayTexUnit(decayTex->getTexUnit());
-	shader->setBBHeight(bbHeight);
-	shader->setBBWidth(bbWidth);
+	shader->setBBHeight(bbHeight * getDrawBBScale());
+	shader->setBBWidth(bbWidth * getDrawBBScale());
 
 	shader->use();
 
-	glBindBuffer(GL_ARRAY_BUFFER, particles_vbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, particles.size()*sizeof(AdvectParticle),
-		particles.data());
-
 	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	
-	glDrawArrays(GL_POINTS, 0, particles.size());
+	glDrawArrays(GL_POINTS, getFirstParticle(), nActive);
 
 	glBindVertexArray(0);
 
 	glUseProgram(0);
 	glDisable(GL_BLEND);
 	glDepthMask(GL_TRUE);
+
+	renderTime = std::chrono::duration<float, std::milli>(
+		std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float AdvectParticles::getDrawAlpha() const
+{
+	// Together with getDrawBBScale(), keeps nActive * alpha * bbArea constant.
+	float density = static_cast<float>(maxParticles) / static_cast<float>(nActive);
+	float alphaScale = sqrt(density);
+	return std::min(alpha * alphaScale, 1.0f);
+}
+
+float AdvectParticles::getDrawBBScale() const
+{
+	float density = static_cast<float>(maxParticles) / static_cast<float>(nActive);
+	return sqrt(sqrt(density));
+}
+
+float AdvectParticles::getLightBBScale() const
+{
+	float density = static_cast<float>(maxParticles) / static_cast<float>(nActive);
+	return sqrt(density);
+}
+
+void AdvectParticles::setNActive(int n)
+{
+	n = std::max(1, std::min(n, maxParticles));
+
+	// Newly active particles are respawned, so they fade in from the base.
+	for(int i = nActive; i < n; ++i)
+		spawnParticle(i);
+	// Inactive particles are left invisible for anything drawing all of them.
+	for(int i = n; i < nActive; ++i)
+		particles[i].decay = 0.0f;
+	// Lights assigned to deactivated particles move to unassigned active 
+	//   ones, so their clumps don't starve.
+	if(!statLight.empty())
+		for(int i = n; i < nActive; ++i)
+		{
+			if(statLight[i] < 0) continue;
+			for(int tries = 0; tries < 8; ++tries)
+			{
+				int target = randi(0, n);
+				if(statLight[target] >= 0) continue;
+				statLight[target] = statLight[i];
+				break;
+			}
+			statLight[i] = -1;
+		}
+
+	nActive = n;
+}
+
+void AdvectParticles::playFrame()
+{
+	if(replay->getMaxParticles() > maxParticles)
+		throw Exception("Particle recording has more particles than its emitter.\n");
+
+	int dTime, n;
+	if(!replay->nextFrame(dTime, n, 
+		posX.data(), posY.data(), posZ.data(), decay.data(), randTex.data()))
+	{
+		// Out of frames, so hold the last one. A batch needs it every frame.
+		if(batch) packAll(1.0f);
+		return;
+	}
+
+	std::copy(posX.begin(), posX.begin() + n, prevX.begin());
+	std::copy(posY.begin(), posY.begin() + n, prevY.begin());
+	std::copy(posZ.begin(), posZ.begin() + n, prevZ.begin());
+	for(int i = n; i < nActive; ++i)
+		particles[i].decay = 0.0f;
+	nActive = n;
+
+	packAll(1.0f);
+}
+
+void AdvectParticles::adaptParticleCount(int maxCount)
+{
+	float cost = updateTime + renderTime;
+	avgCost = avgCost < 0.0f ? cost : avgCost + 0.1f * (cost - avgCost);
+
+	// Aim for the count expected to meet the budget, unless close enough.
+	float ratio = frameBudget / std::max(avgCost, 1e-3f);
+	int target = (ratio > 0.9f && ratio < 1.1f) ? nActive : static_cast<int>(nActive * ratio);
+	moveNActiveTowards(std::max(minParticles, std::min(target, maxCount)));
+}
+
+void AdvectParticles::moveNActiveTowards(int target)
+{
+	int maxChange = std::max(1, maxParticles / 50);
+	setNActive(nActive + std::max(-maxChange, std::min(target - nActive, maxChange)));
+}
+
+float AdvectParticles::getProjectedSize()
+{
+	if(!scene) return 1.0f;
+
+	CameraBlock& block = scene->camera->getBlock();
+	float dist = glm::length(glm::vec3(getOrigin() - block.cameraPos));
+	float halfHeight = dist * tan(scene->camera->getFOV() * 0.5f * PI / 180.0f);
+	return halfHeight > EPS ? lodRadius / halfHeight : 1.0f;
+}
+
+int AdvectParticles::findLODCount()
+{
+	lodStepScale = 1;
+	if(lodSize <= 0.0f) return maxParticles;
+
+	float ratio = getProjectedSize() / lodSize;
+	if(ratio >= 1.0f) return maxParticles;
+
+	lodStepScale = std::max(1, std::min(lodMaxStepScale, 
+		static_cast<int>(1.0f / std::max(ratio, EPS))));
+	return std::max(minParticles, static_cast<int>(maxParticles * ratio * ratio));
 }
 
 void AdvectParticles::setShader(ParticleShader* shader)
@@ -142,12 +304,6 @@ void AdvectParticles::setShader(ParticleShader* shader)
 	shader->setBBTexUnit(bbTex->getTexUnit());
 	shader->setDecayTexUnit(decayTex->getTexUnit());
 
-	// Set up vertex buffer objects.
-	glGenBuffers(1, &particles_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, particles_vbo);
-	glBufferData(GL_ARRAY_BUFFER, particles.size()*sizeof(AdvectParticle),
-		particles.data(), GL_DYNAMIC_DRAW);
-
 	// Set up uniforms.
 	shader->setBBWidth(bbWidth);
 	shader->setBBHeight(bbHeight);
@@ -161,48 +317,467 @@ void AdvectParticles::setShader(ParticleShader* shader)
 	glEnableVertexAttribArray(pos_attrib);
 	glEnableVertexAttribArray(decay_attrib);
 	glEnableVertexAttribArray(randTex_attrib);
-	glVertexAttribPointer(pos_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle),
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, pos)));
-	glVertexAttribPointer(decay_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle), 
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, decay)));
-	glVertexAttribPointer(randTex_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle), 
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, randTex)));
+	glVertexAttribPointer(pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedAdvectParticle),
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, pos)));
+	glVertexAttribPointer(decay_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, decay)));
+	glVertexAttribPointer(randTex_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, randTex)));
 
 	glBindVertexArray(0);
 }
 
 void AdvectParticles::update(int dTime)
 {
-	if(dTime > 1000) return; // Avoid updating if timestep excessive
+	if(replay)
+	{
+		playFrame();
+		return;
+	}
+
+	int maxCount = findLODCount();
+	if(frameBudget > 0.0f) adaptParticleCount(maxCount);
+	else if(lodSize > 0.0f) moveNActiveTowards(maxCount);
+	else if(nActive < maxParticles) setNActive(maxParticles);
+	std::chrono::high_resolution_clock::time_point start = 
+		std::chrono::high_resolution_clock::now();
+
+	// Drop any time beyond maxSubsteps steps (e.g. after a stall), rather
+	//   than trying to catch up & falling further behind.
+	int stepLength = simStep * lodStepScale;
+	accumulator = std::min(accumulator + dTime, maxSubsteps * stepLength);
+	while(accumulator >= stepLength)
+	{
+		step(stepLength);
+		accumulator -= stepLength;
+	}
+
+	packAll(interpolate ? 
+		static_cast<float>(accumulator) / static_cast<float>(stepLength) : 1.0f);
+
+	if(recorder) recorder->addFrame(dTime, particles.data(), nActive);
+
+	updateTime = std::chrono::duration<float, std::milli>(
+		std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void AdvectParticles::packAll(float t)
+{
+	findPackBounds();
+
+	// Batched emitters pack straight into their slice of the batch's stream,
+	//   & only fill their own as well if something else draws from it.
+	PackedAdvectParticle* slice = batch ? batch->getSlice(this) : nullptr;
+	PackedAdvectParticle* own = !slice || needsOwnStream() ?
+		static_cast<PackedAdvectParticle*>(particleStream->map()) : nullptr;
+	PackedAdvectParticle* out = slice ? slice : own;
+	PackedAdvectParticle* copy = slice ? own : nullptr;
+	int nBlocks = (nActive + simdWidth - 1) / simdWidth;
+	int nLights = static_cast<int>(lightStats.size());
+
+	if(nLights > 0)
+	{
+		LightStats zero = {glm::vec4(0.0f), glm::vec4(0.0f), 0};
+		threadStats.assign(omp_get_max_threads() * nLights, zero);
+	}
+
 	#pragma omp parallel for
-	for(int i = 0; i < maxParticles; ++i)
-		updateParticle(i, dTime);
+	for(int block = 0; block < nBlocks; ++block)
+	{
+		int first = block * simdWidth;
+		LightStats* stats = nLights > 0 ? &threadStats[omp_get_thread_num() * nLights] : nullptr;
+		packBlock(first, std::min(simdWidth, nActive - first), t, out, copy, stats);
+	}
+
+	if(own) particleStream->unmap();
+
+	// Combine the sums from each thread.
+	for(int l = 0; l < nLights; ++l)
+	{
+		LightStats sum = {glm::vec4(0.0f), glm::vec4(0.0f), 0};
+		for(size_t s = l; s < threadStats.size(); s += nLights)
+		{
+			sum.posSum += threadStats[s].posSum;
+			sum.colorSum += threadStats[s].colorSum;
+			sum.count += threadStats[s].count;
+		}
+		lightStats[l] = sum;
+	}
+
+	if(clusterLights) updateClusters();
+}
+
+void AdvectParticles::findPackBounds()
+{
+	int nBlocks = (nActive + simdWidth - 1) / simdWidth;
+	float big = std::numeric_limits<float>::max();
+	threadBounds.resize(omp_get_max_threads() * 2);
+	for(size_t b = 0; b < threadBounds.size(); b += 2)
+	{
+		threadBounds[b] = glm::vec3(big);
+		threadBounds[b+1] = glm::vec3(-big);
+	}
+
+	#pragma omp parallel for
+	for(int block = 0; block < nBlocks; ++block)
+	{
+		glm::vec3& lo = threadBounds[omp_get_thread_num() * 2];
+		glm::vec3& hi = threadBounds[omp_get_thread_num() * 2 + 1];
+		int end = std::min(block * simdWidth + simdWidth, nActive);
+		for(int i = block * simdWidth; i < end; ++i)
+		{
+			lo.x = std::min(lo.x, std::min(posX[i], prevX[i]));
+			lo.y = std::min(lo.y, std::min(posY[i], prevY[i]));
+			lo.z = std::min(lo.z, std::min(posZ[i], prevZ[i]));
+			hi.x = std::max(hi.x, std::max(posX[i], prevX[i]));
+			hi.y = std::max(hi.y, std::max(posY[i], prevY[i]));
+			hi.z = std::max(hi.z, std::max(posZ[i], prevZ[i]));
+		}
+	}
+
+	glm::vec3 lo = threadBounds[0], hi = threadBounds[1];
+	for(size_t b = 2; b < threadBounds.size(); b += 2)
+	{
+		lo = glm::min(lo, threadBounds[b]);
+		hi = glm::max(hi, threadBounds[b+1]);
+	}
+
+	packMin = lo;
+	packScale = glm::max(hi - lo, glm::vec3(EPS));
+}
+
+glm::mat4 AdvectParticles::getPackToWorld() const
+{
+	glm::mat4 unpack(1.0f);
+	unpack[0][0] = packScale.x;
+	unpack[1][1] = packScale.y;
+	unpack[2][2] = packScale.z;
+	unpack[3] = glm::vec4(packMin, 1.0f);
+	return modelToWorld * unpack;
+}
+
+void AdvectParticles::initLightStats(int nLights, 
+	const std::vector<glm::vec4>& colors, bool weightByDecay)
+{
+	LightStats zero = {glm::vec4(0.0f), glm::vec4(0.0f), 0};
+	lightStats.assign(nLights, zero);
+	statColors = colors;
+	statWeightByDecay = weightByDecay;
+	statLight.assign(maxParticles, -1);
+}
+
+void AdvectParticles::assignLight(int particle, int light)
+{
+	statLight[particle] = light;
+}
+
+void AdvectParticles::clearLightAssignments()
+{
+	std::fill(statLight.begin(), statLight.end(), -1);
+}
+
+void AdvectParticles::setLightClustering(bool clustering)
+{
+	clusterLights = clustering;
+	if(!clustering) return;
+
+	// Seed clusters at random particles.
+	clusterCenters.resize(lightStats.size());
+	for(auto c = clusterCenters.begin(); c != clusterCenters.end(); ++c)
+		*c = particles[randi(0, nActive)].pos;
+}
+
+int AdvectParticles::nearestCluster(const glm::vec4& pos) const
+{
+	int nearest = 0;
+	float nearestDistSq = std::numeric_limits<float>::max();
+	for(size_t c = 0; c < clusterCenters.size(); ++c)
+	{
+		glm::vec3 d = glm::vec3(pos - clusterCenters[c]);
+		float distSq = glm::dot(d, d);
+		if(distSq < nearestDistSq)
+		{
+			nearest = static_cast<int>(c);
+			nearestDistSq = distSq;
+		}
+	}
+	return nearest;
+}
+
+void AdvectParticles::updateClusters()
+{
+	// Move each center to the centroid of its particles, ready for the next
+	//   assignment. Clusters left empty are moved to a random particle.
+	for(size_t c = 0; c < clusterCenters.size(); ++c)
+	{
+		if(lightStats[c].count > 0)
+			clusterCenters[c] = lightStats[c].posSum / static_cast<float>(lightStats[c].count);
+		else
+			clusterCenters[c] = particles[randi(0, nActive)].pos;
+	}
+}
+
+GLint AdvectParticles::getFirstParticle() const
+{
+	return particleStream->getFirst(sizeof(PackedAdvectParticle));
 }
 
-void AdvectParticles::updateParticle(int index, int dTime)
+void AdvectParticles::step(int dTime)
 {
-	time[index] += dTime;
-	if(time[index] > lifeTime[index]) spawnParticle(index);
-	particles[index].decay = ((float) time[index]) / ((float) lifeTime[index]);
-	perturbCounter[index] += dTime;
+	int nBlocks = (nActive + simdWidth - 1) / simdWidth;
+	glm::mat3 toModel = glm::inverse(glm::mat3(modelToWorld));
+
+	colliderToObject.resize(colliders.size());
+	colliderFromObject.resize(colliders.size());
+	for(size_t c = 0; c < colliders.size(); ++c)
+	{
+		colliderToObject[c] = glm::inverse(colliders[c].object->getModelToWorld()) * modelToWorld;
+		colliderFromObject[c] = glm::inverse(colliderToObject[c]);
+	}
+
+	if(static_cast<int>(spawnRNGs.size()) < omp_get_max_threads()) seedSpawnRNGs();
 
-	if(perturbCounter[index] >= perturbTime[index] && perturbOn)
+	#pragma omp parallel for
+	for(int block = 0; block < nBlocks; ++block)
 	{
-		perturbCounter[index] = 0;
-		perturbTime[index] = avgPerturbTime + randi(-varPerturbTime, varPerturbTime);
-		vel[index] = perturb(vel[index]);
+		int first = block * simdWidth;
+		int count = std::min(simdWidth, nActive - first);
+
+		std::copy(posX.begin() + first, posX.begin() + first + count, prevX.begin() + first);
+		std::copy(posY.begin() + first, posY.begin() + first + count, prevY.begin() + first);
+		std::copy(posZ.begin() + first, posZ.begin() + first + count, prevZ.begin() + first);
+		if(forceField || fluid)
+			applyFields(first, count, static_cast<float>(dTime), modelToWorld, toModel);
+#ifdef __AVX2__
+		if(count == simdWidth)
+			updateBlockAVX2(first, dTime);
+		else
+			updateBlock(first, count, dTime);
+#else
+		updateBlock(first, count, dTime);
+#endif
+		if(!colliders.empty())
+			collideBlock(first, count);
 	}
+}
+
+void AdvectParticles::collideBlock(int first, int count)
+{
+	for(size_t c = 0; c < colliders.size(); ++c)
+	{
+		const Collider& collider = colliders[c];
+		const glm::mat4& toObject = colliderToObject[c];
+		const glm::mat4& fromObject = colliderFromObject[c];
+
+		for(int i = first; i < first + count; ++i)
+		{
+			glm::vec3 pos(toObject * glm::vec4(posX[i], posY[i], posZ[i], 1.0f));
+			float dist = collider.sdf->distance(pos);
+			if(dist >= collider.radius) continue;
+
+			glm::vec3 normal = collider.sdf->gradient(pos);
+			float len = glm::length(normal);
+			if(len < EPS) continue;
+			normal /= len;
 
-	vel[index] += static_cast<float>(dTime) *
-		(acn[index] + (glm::vec4(
-			-particles[index].pos.x,
-			0.0,
-			-particles[index].pos.z,
-			0.0)
-			* centerForce));
+			// Push out to the surface, then reflect velocity into it.
+			pos += normal * (collider.radius - dist);
+
+			glm::vec3 vel = glm::mat3(toObject) * glm::vec3(velX[i], velY[i], velZ[i]);
+			float into = glm::dot(vel, normal);
+			if(into < 0.0f)
+			{
+				glm::vec3 along = vel - into * normal;
+				vel = along * (1.0f - collider.friction) - normal * (into * collider.bounce);
+			}
 
-	vel[index] += static_cast<float>(dTime) * extForce;
-	particles[index].pos += (float) dTime * vel[index];
+			glm::vec3 newPos(fromObject * glm::vec4(pos, 1.0f));
+			glm::vec3 newVel = glm::mat3(fromObject) * vel;
+			posX[i] = newPos.x; posY[i] = newPos.y; posZ[i] = newPos.z;
+			velX[i] = newVel.x; velY[i] = newVel.y; velZ[i] = newVel.z;
+		}
+	}
+}
+
+void AdvectParticles::applyFields(int first, int count, float dt,
+	const glm::mat4& toWorld, const glm::mat3& toModel)
+{
+	float x[simdWidth], y[simdWidth], z[simdWidth];
+	float outX[simdWidth], outY[simdWidth], outZ[simdWidth];
+
+	for(int j = 0, i = first; j < count; ++j, ++i)
+	{
+		glm::vec4 worldPos = toWorld * glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+		x[j] = worldPos.x; y[j] = worldPos.y; z[j] = worldPos.z;
+	}
+
+	if(forceField)
+	{
+		forceField->sample(x, y, z, count, outX, outY, outZ);
+
+		for(int j = 0, i = first; j < count; ++j, ++i)
+		{
+			glm::vec3 force = toModel * glm::vec3(outX[j], outY[j], outZ[j]);
+			velX[i] += dt * force.x;
+			velY[i] += dt * force.y;
+			velZ[i] += dt * force.z;
+		}
+	}
+
+	if(fluid)
+	{
+		fluid->sampleVelocity(x, y, z, count, outX, outY, outZ);
+		float pull = std::min(1.0f, dt * fluidDrag);
+
+		for(int j = 0, i = first; j < count; ++j, ++i)
+		{
+			glm::vec3 flow = toModel * glm::vec3(outX[j], outY[j], outZ[j]);
+			velX[i] += pull * (flow.x - velX[i]);
+			velY[i] += pull * (flow.y - velY[i]);
+			velZ[i] += pull * (flow.z - velZ[i]);
+		}
+	}
+}
+
+void AdvectParticles::updateBlock(int first, int count, int dTime)
+{
+	float dt = static_cast<float>(dTime);
+
+	int spawnMask = 0;
+	for(int j = 0, i = first; j < count; ++j, ++i)
+	{
+		time[i] += dTime;
+		if(time[i] > lifeTime[i]) spawnMask |= 1 << j;
+	}
+	for(int j = 0; j < count; ++j)
+		if(spawnMask & (1 << j)) spawnParticle(first + j);
+
+	int perturbMask = 0;
+	for(int j = 0, i = first; j < count; ++j, ++i)
+	{
+		decay[i] = static_cast<float>(time[i]) / static_cast<float>(lifeTime[i]);
+		perturbCounter[i] += dTime;
+		if(perturbCounter[i] >= perturbTime[i]) perturbMask |= 1 << j;
+	}
+	if(perturbOn)
+		for(int j = 0; j < count; ++j)
+			if(perturbMask & (1 << j)) perturbParticle(first + j);
+
+	for(int i = first; i < first + count; ++i)
+	{
+		velX[i] += dt * (acnX[i] - posX[i] * centerForce) + dt * extForce.x;
+		velY[i] += dt * acnY[i] + dt * extForce.y;
+		velZ[i] += dt * (acnZ[i] - posZ[i] * centerForce) + dt * extForce.z;
+		posX[i] += dt * velX[i];
+		posY[i] += dt * velY[i];
+		posZ[i] += dt * velZ[i];
+	}
+}
+
+#ifdef __AVX2__
+void AdvectParticles::updateBlockAVX2(int first, int dTime)
+{
+	const __m256i dti = _mm256_set1_epi32(dTime);
+	const __m256 dt = _mm256_set1_ps(static_cast<float>(dTime));
+
+	// Age particles, and respawn any which have died.
+	__m256i t = _mm256_add_epi32(
+		_mm256_load_si256(reinterpret_cast<const __m256i*>(&time[first])), dti);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(&time[first]), t);
+	__m256i life = _mm256_load_si256(reinterpret_cast<const __m256i*>(&lifeTime[first]));
+	int spawnMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(t, life)));
+	if(spawnMask)
+	{
+		for(int j = 0; j < simdWidth; ++j)
+			if(spawnMask & (1 << j)) spawnParticle(first + j);
+		t = _mm256_load_si256(reinterpret_cast<const __m256i*>(&time[first]));
+		life = _mm256_load_si256(reinterpret_cast<const __m256i*>(&lifeTime[first]));
+	}
+
+	_mm256_store_ps(&decay[first], 
+		_mm256_div_ps(_mm256_cvtepi32_ps(t), _mm256_cvtepi32_ps(life)));
+
+	// Perturb particles whose counter has reached perturbTime.
+	__m256i counter = _mm256_add_epi32(
+		_mm256_load_si256(reinterpret_cast<const __m256i*>(&perturbCounter[first])), dti);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(&perturbCounter[first]), counter);
+	if(perturbOn)
+	{
+		__m256i pTime = _mm256_load_si256(reinterpret_cast<const __m256i*>(&perturbTime[first]));
+		int perturbMask = ~_mm256_movemask_ps(
+			_mm256_castsi256_ps(_mm256_cmpgt_epi32(pTime, counter))) & 0xff;
+		for(int j = 0; j < simdWidth; ++j)
+			if(perturbMask & (1 << j)) perturbParticle(first + j);
+	}
+
+	// Integrate.
+	const __m256 cf = _mm256_set1_ps(centerForce);
+	__m256 px = _mm256_load_ps(&posX[first]);
+	__m256 py = _mm256_load_ps(&posY[first]);
+	__m256 pz = _mm256_load_ps(&posZ[first]);
+	__m256 vx = _mm256_load_ps(&velX[first]);
+	__m256 vy = _mm256_load_ps(&velY[first]);
+	__m256 vz = _mm256_load_ps(&velZ[first]);
+
+	__m256 ax = _mm256_add_ps(_mm256_sub_ps(_mm256_load_ps(&acnX[first]), 
+		_mm256_mul_ps(px, cf)), _mm256_set1_ps(extForce.x));
+	__m256 ay = _mm256_add_ps(_mm256_load_ps(&acnY[first]), _mm256_set1_ps(extForce.y));
+	__m256 az = _mm256_add_ps(_mm256_sub_ps(_mm256_load_ps(&acnZ[first]), 
+		_mm256_mul_ps(pz, cf)), _mm256_set1_ps(extForce.z));
+
+	vx = _mm256_add_ps(vx, _mm256_mul_ps(dt, ax));
+	vy = _mm256_add_ps(vy, _mm256_mul_ps(dt, ay));
+	vz = _mm256_add_ps(vz, _mm256_mul_ps(dt, az));
+
+	_mm256_store_ps(&velX[first], vx);
+	_mm256_store_ps(&velY[first], vy);
+	_mm256_store_ps(&velZ[first], vz);
+	_mm256_store_ps(&posX[first], _mm256_add_ps(px, _mm256_mul_ps(dt, vx)));
+	_mm256_store_ps(&posY[first], _mm256_add_ps(py, _mm256_mul_ps(dt, vy)));
+	_mm256_store_ps(&posZ[first], _mm256_add_ps(pz, _mm256_mul_ps(dt, vz)));
+}
+#endif
+
+void AdvectParticles::packBlock(int first, int count, float t, 
+	PackedAdvectParticle* out, PackedAdvectParticle* copy, LightStats* stats)
+{
+	// Rounds to the nearest step, & never past 65535 from rounding error.
+	glm::vec3 toSteps = glm::vec3(65535.0f) / packScale;
+	glm::vec3 offset = glm::vec3(0.5f) - packMin * toSteps;
+	for(int i = first; i < first + count; ++i)
+	{
+		AdvectParticle p;
+		p.pos = glm::vec4(
+			prevX[i] + t * (posX[i] - prevX[i]),
+			prevY[i] + t * (posY[i] - prevY[i]),
+			prevZ[i] + t * (posZ[i] - prevZ[i]),
+			1.0f);
+		p.decay = decay[i];
+		p.randTex = randTex[i];
+		particles[i] = p;
+
+		glm::vec3 steps = glm::min(glm::vec3(p.pos) * toSteps + offset, glm::vec3(65535.0f));
+		PackedAdvectParticle q;
+		q.pos[0] = static_cast<GLushort>(steps.x);
+		q.pos[1] = static_cast<GLushort>(steps.y);
+		q.pos[2] = static_cast<GLushort>(steps.z);
+		q.decay = static_cast<GLubyte>(std::min(std::max(p.decay, 0.0f), 1.0f) * 255.0f + 0.5f);
+		q.randTex = static_cast<GLubyte>(p.randTex * 255.0f + 0.5f);
+		out[i] = q;
+		if(copy) copy[i] = q;
+
+		int light = !stats ? -1 : clusterLights ? nearestCluster(p.pos) : statLight[i];
+		if(light >= 0)
+		{
+			LightStats& s = stats[light];
+			int pixel = static_cast<int>(p.decay * (statColors.size()-1));
+			float weight = statWeightByDecay ? 
+				(p.decay < 0.3f ? p.decay : (1.0f - p.decay)) : 1.0f;
+			s.posSum += p.pos;
+			s.colorSum += statColors[pixel] * weight;
+			++s.count;
+		}
+	}
 }
 
 void AdvectParticles::spawnParticle(int index)
@@ -211,17 +786,42 @@ void AdvectParticles::spawnParticle(int index)
 	lifeTime[index] = avgLifetime + randi(-varLifetime, +varLifetime);
 	perturbCounter[index] = 0;
 	perturbTime[index] = avgPerturbTime + randi(-varPerturbTime, varPerturbTime);
-	particles[index].decay = 0.0;
-	acn[index] = initAcn;
-	particles[index].pos = randInitPos();
-	vel[index] = getInitVel(particles[index].pos);
-	particles[index].randTex = randf(0.0f, 1.0f);
+	decay[index] = 0.0;
+	acnX[index] = initAcn.x; acnY[index] = initAcn.y; acnZ[index] = initAcn.z;
+	glm::vec4 outward;
+	glm::vec4 pos = randInitPos(outward);
+	posX[index] = pos.x; posY[index] = pos.y; posZ[index] = pos.z;
+	// Don't interpolate from where the particle died.
+	prevX[index] = pos.x; prevY[index] = pos.y; prevZ[index] = pos.z;
+	glm::vec4 vel = getInitVel(outward);
+	velX[index] = vel.x; velY[index] = vel.y; velZ[index] = vel.z;
+	randTex[index] = randf(0.0f, 1.0f);
+}
+
+void AdvectParticles::perturbParticle(int index)
+{
+	perturbCounter[index] = 0;
+	perturbTime[index] = avgPerturbTime + randi(-varPerturbTime, varPerturbTime);
+	glm::vec4 vel = perturb(glm::vec4(velX[index], velY[index], velZ[index], 0.0f));
+	velX[index] = vel.x; velY[index] = vel.y; velZ[index] = vel.z;
 }
 
-glm::vec4 AdvectParticles::randInitPos()
+glm::vec4 AdvectParticles::randInitPos(glm::vec4& outward)
 {
+	if(emitter)
+	{
+		std::mt19937& rng = spawnRNGs[omp_get_thread_num()];
+		std::uniform_int_distribution<int> column(0, emitter->getNTriangles() - 1);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		glm::vec3 pos, norm;
+		emitter->sample(column(rng), unit(rng), unit(rng), unit(rng), pos, norm);
+		outward = glm::vec4(norm, 0.0f);
+		return glm::vec4(pos, 1.0f);
+	}
+
 	float theta = randf(0.0f, 2.0f * PI);
 	float radius = randf(0.0f, baseRadius);
+	outward = glm::vec4(radius*cos(theta), 0.0, radius*sin(theta), 0.0);
 	return glm::vec4(radius*cos(theta), 0.0, radius*sin(theta), 1.0);
 }
 
@@ -232,9 +832,9 @@ glm::vec4 AdvectParticles::perturb(glm::vec4 input)
 	return input + glm::vec4(radius * cos(theta), 0.0, radius * sin(theta), 0.0);
 }
 
-glm::vec4 AdvectParticles::getInitVel(const glm::vec4& pos)
+glm::vec4 AdvectParticles::getInitVel(const glm::vec4& outward)
 {
-	return glm::vec4(pos.x, pos.y, pos.z, 0.0f) * initVel +
+	return outward * initVel +
 		glm::vec4(0.0f, 1.0f, 0.0f, 0.0f) * initUpVel;
 
 }
@@ -251,6 +851,13 @@ int AdvectParticles::randi(int low, int high)
 	return r + low;
 }
 
+void AdvectParticles::seedSpawnRNGs()
+{
+	spawnRNGs.clear();
+	for(int i = 0; i < omp_get_max_threads(); ++i)
+		spawnRNGs.push_back(std::mt19937(rand() + i * 7919));
+}
+
 std::vector<glm::vec4> AdvectParticles::loadImage(const std::string& filename)
 {
 	std::string fullPath = "../textures/" + filename;
@@ -363,25 +970,30 @@ AdvectParticlesCentroidLights::AdvectParticlesCentroidLights(
 
 void AdvectParticlesCentroidLights::init()
 {
-	for(int i = 0; i < nLights; ++i)
-	{
-		std::vector<int> clump;
-		for(int j = 0; j < clumpSize; ++j)
-			clump.push_back(randi(0, maxParticles));
-		clumps.push_back(clump);
-	}
+	// Colours are scaled by the current light intensity in updateLights().
+	std::vector<glm::vec4> colors;
+	for(auto i = particleColors.begin(); i != particleColors.end(); ++i)
+		colors.push_back(glm::vec4(
+			saturate(i->x, minColor), saturate(i->y, minColor), saturate(i->z, minColor),
+			1.0f));
+	initLightStats(nLights, colors, true);
+	randomizeClumps();
 }
 
 void AdvectParticlesCentroidLights::randomizeClumps()
 {
-	for(auto i = clumps.begin(); i != clumps.end(); ++i)
-		for(auto j = i->begin(); j != i->end(); ++j)
-			(*j) = randi(0, maxParticles);
+	clearLightAssignments();
+	for(int i = 0; i < nLights; ++i)
+		for(int j = 0; j < clumpSize; ++j)
+			assignLight(randi(0, getNActive()), i);
 }
 
 void AdvectParticlesCentroidLights::updateLights()
 {
-	if(interval == 0)
+	// Clustered lights follow the particles, so are never re-randomized.
+	if(getLightClustering())
+		counter = 0;
+	else if(interval == 0)
 		randomizeClumps();
 	else if(interval > 0)
 	{
@@ -395,29 +1007,15 @@ void AdvectParticlesCentroidLights::updateLights()
 
 	for(int i = 0; i < nLights; ++i)
 	{
-		lights[i]->setPos(modelToWorld * getParticleCentroid(clumps[i]));
-		lights[i]->setColor(getAverageColor(clumps[i]));
+		const LightStats& stats = getLightStats(i);
+		if(stats.count == 0) continue;
+		float n = static_cast<float>(stats.count);
+		lights[i]->setPos(modelToWorld * (stats.posSum / n));
+		lights[i]->setColor(glm::vec4(
+			glm::vec3(stats.colorSum) * (getLightIntensity() / n), 1.0f));
 	}
 }
 
-glm::vec4 AdvectParticlesCentroidLights::getParticleCentroid(
-	const std::vector<int>& clump)
-{
-	glm::vec4 sum;
-	for(auto i = clump.begin(); i != clump.end(); ++i)
-		sum += particles[*i].pos;
-	return sum / static_cast<float>(clump.size());
-}
-
-glm::vec4 AdvectParticlesCentroidLights::getAverageColor(
-	const std::vector<int>& clump)
-{
-	glm::vec4 color;
-	for(auto i = clump.begin(); i != clump.end(); ++i)
-		color += getParticleColor(particles[*i].decay);
-	return color / static_cast<float>(clump.size());
-}
-
 AdvectParticlesSHLights::AdvectParticlesSHLights(
 	Renderable* targetObj,
 	float intensity,
@@ -509,25 +1107,29 @@ AdvectParticlesCentroidSHLights::AdvectParticlesCentroidSHLights(
 
 void AdvectParticlesCentroidSHLights::init()
 {
-	for(int i = 0; i < nLights; ++i)
-	{
-		std::vector<int> clump;
-		for(int j = 0; j < clumpSize; ++j)
-			clump.push_back(randi(0, maxParticles));
-		clumps.push_back(clump);
-	}
+	std::vector<glm::vec4> colors;
+	for(auto i = particleColors.begin(); i != particleColors.end(); ++i)
+		colors.push_back(glm::vec4(
+			saturate(i->x, minColor), saturate(i->y, minColor), saturate(i->z, minColor),
+			1.0f));
+	initLightStats(nLights, colors, false);
+	randomizeClumps();
 }
 
 void AdvectParticlesCentroidSHLights::randomizeClumps()
 {
-	for(auto i = clumps.begin(); i != clumps.end(); ++i)
-		for(auto j = i->begin(); j != i->end(); ++j)
-			(*j) = randi(0, maxParticles);
+	clearLightAssignments();
+	for(int i = 0; i < nLights; ++i)
+		for(int j = 0; j < clumpSize; ++j)
+			assignLight(randi(0, getNActive()), i);
 }
 
 void AdvectParticlesCentroidSHLights::updateLights()
 {
-	if(interval == 0)
+	// Clustered lights follow the particles, so are never re-randomized.
+	if(getLightClustering())
+		counter = 0;
+	else if(interval == 0)
 		randomizeClumps();
 	else if(interval > 0)
 	{
@@ -543,49 +1145,59 @@ void AdvectParticlesCentroidSHLights::updateLights()
 
 	for(int i = 0; i < nLights; ++i)
 	{
-		lights[i]->pointAt(glm::vec3(toTarget * getParticleCentroid(clumps[i])));
-		lights[i]->setColor(getAverageColor(clumps[i]));
+		const LightStats& stats = getLightStats(i);
+		if(stats.count == 0) continue;
+		float n = static_cast<float>(stats.count);
+		lights[i]->pointAt(glm::vec3(toTarget * (stats.posSum / n)));
+		lights[i]->setColor(glm::vec3(stats.colorSum) / n);
 	}
 }
 
-glm::vec4 AdvectParticlesCentroidSHLights::getParticleCentroid(
-	const std::vector<int>& clump)
-{
-	glm::vec4 sum;
-	for(auto i = clump.begin(); i != clump.end(); ++i)
-		sum += particles[*i].pos;
-	return sum / (float) clump.size();
-}
-
-glm::vec3 AdvectParticlesCentroidSHLights::getAverageColor(
-	const std::vector<int>& clump)
-{
-	glm::vec3 color;
-	for(auto i = clump.begin(); i != clump.end(); ++i)
-		color += getParticleColor(particles[*i].decay);
-	return color / static_cast<float>(clump.size());
-}
-
 AdvectParticlesSHCubemap::AdvectParticlesSHCubemap(
 	Renderable* targetObj,
 	int maxParticles, ParticleShader* shader, 
 	float intensity,
-	Texture* bbTex, Texture* decayTex)
+	Texture* bbTex, Texture* decayTex,
+	int cubemapSize, GLenum cubemapFormat)
 	:AdvectParticles(maxParticles, shader, bbTex, decayTex),
-	 targetObj(targetObj), intensity(intensity), 
-	 clearColor(glm::vec4(0.0f)), ambColor(glm::vec4(0.0f))
+	 light(nullptr), amb(nullptr),
+	 clearColor(glm::vec4(0.0f)), ambColor(glm::vec4(0.0f)),
+	 asyncReadback(true), layeredRender(true), softwareSplat(false),
+	 facesPerFrame(6), prioritizeEnergy(false), maxFaceAge(6),
+	 targetObj(targetObj),
+	 cubemapSize(cubemapSize), cubemapPixels(cubemapSize * cubemapSize),
+	 cubemapFormat(cubemapFormat),
+	 gpuProjection(false), intensity(intensity)
 { init(); }
 
 void AdvectParticlesSHCubemap::update(int dTime)
 {
 	AdvectParticles::update(dTime);
-	renderCubemap();
-	updateLight();
+	if(gpuProjection)
+	{
+		if(!light) return;
+		renderCubemap(false, false);
+		reduction->project(layeredTexUnit);
+		scene->shManager.markChanged();
+		return;
+	}
+	filter.update(dTime, light, 
+		[this] () -> std::vector<glm::vec3>
+		{
+			if(this->softwareSplat) return this->splatCubemap();
+			if(this->facesPerFrame < 6)
+			{
+				this->renderCubemap(false, true, this->chooseFaces());
+				return this->projectDirtyFaces();
+			}
+			this->renderCubemap();
+			return this->projectCubemap();
+		});
 }
 
 void AdvectParticlesSHCubemap::onAdd()
 {
-	renderCubemap();
+	renderCubemap(true);
 	light = scene->add(new SHLight(
 			[this] (float theta, float phi) -> glm::vec3
 			{
@@ -600,6 +1212,21 @@ void AdvectParticlesSHCubemap::onAdd()
 
 	if(light == nullptr || amb == nullptr)
 		std::cout << "Warning: SH lights could not all be added.\n"; 
+	else if(gpuProjection)
+	{
+		updateReductionScale();
+		light->setCoeffts(std::vector<glm::vec3>(GC::nSHCoeffts, glm::vec3(0.0f)));
+		scene->shManager.addGPUSource(reduction);
+		renderCubemap(false, false);
+		reduction->project(layeredTexUnit);
+	}
+	else
+		light->setCoeffts(projectCubemap());
+}
+
+void AdvectParticlesSHCubemap::onRemove()
+{
+	scene->shManager.removeGPUSource(reduction);
 }
 
 void AdvectParticlesSHCubemap::saveCubemap()
@@ -610,26 +1237,125 @@ void AdvectParticlesSHCubemap::saveCubemap()
 void AdvectParticlesSHCubemap::setIntensity(float intensity)
 {
 	this->intensity = intensity;
-	light->setIntensity(intensity);
+	if(light) light->setIntensity(intensity);
+	updateReductionScale();
+}
+
+void AdvectParticlesSHCubemap::updateReductionScale()
+{
+	// Matches the scaling light applies to coeffts projected on the CPU.
+	glm::vec3 color = light ? light->getColor() : glm::vec3(1.0f);
+	reduction->scale = intensity * color;
+}
+
+void AdvectParticlesSHCubemap::setGPUProjection(bool gpuProjection)
+{
+	if(this->gpuProjection == gpuProjection) return;
+	this->gpuProjection = gpuProjection;
+	if(!light) return; // onAdd() will set up the chosen path.
+
+	if(gpuProjection)
+	{
+		light->setCoeffts(std::vector<glm::vec3>(GC::nSHCoeffts, glm::vec3(0.0f)));
+		scene->shManager.addGPUSource(reduction);
+	}
+	else
+	{
+		scene->shManager.removeGPUSource(reduction);
+		filter.reset();
+		renderCubemap(true);
+		light->setCoeffts(projectCubemap());
+	}
+}
+
+float AdvectParticlesSHCubemap::compareProjections()
+{
+	// Both projections must see the same faces, so render them layered.
+	bool layered = layeredRender;
+	layeredRender = true;
+	renderCubemap(true);
+	layeredRender = layered;
+	reduction->project(layeredTexUnit);
+
+	std::vector<glm::vec3> gpu = reduction->readCoeffts();
+	std::vector<glm::vec3> cpu = projectCubemap();
+
+	float maxError = 0.0f;
+	for(int c = 0; c < GC::nSHCoeffts; ++c)
+	{
+		glm::vec3 error = glm::abs(gpu[c] - cpu[c]);
+		maxError = std::max(maxError, std::max(error.x, std::max(error.y, error.z)));
+	}
+
+	float dc = std::max(fabs(cpu[0].x), std::max(fabs(cpu[0].y), fabs(cpu[0].z)));
+	return dc > EPS ? maxError / dc : maxError;
 }
 
 void AdvectParticlesSHCubemap::setAmbIntensity(float ambIntensity)
 {
 	this->ambIntensity = ambIntensity;
-	amb->setIntensity(ambIntensity);
+	if(amb) amb->setIntensity(ambIntensity);
 }
 
 void AdvectParticlesSHCubemap::init()
 {
 	cubemapShader = new CubemapShader(true, false, "FireLight");
+	layeredShader = new CubemapShader(true, false, "FireLightLayered", true);
+
+	glm::mat4 faceRotations[6];
+	for(int face = 0; face < 6; ++face)
+		faceRotations[face] = getRotation(face);
+	layeredShader->setFaceRotations(faceRotations);
 
 	glGenFramebuffers(1, &framebuffer);
+
+	// Layered target for rendering all faces in one pass, one layer per face.
+	layeredTexUnit = Texture::genTexUnit();
+	glActiveTexture(GL_TEXTURE0 + layeredTexUnit);
+	glGenTextures(1, &layeredTex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layeredTex);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, cubemapFormat, 
+		cubemapSize, cubemapSize, 6, 
+		0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	glGenFramebuffers(1, &layeredFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, layeredFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layeredTex, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw Exception("Layered cubemap framebuffer is incomplete.\n");
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	
 	glGenRenderbuffers(1, &renderbuffer);
 	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, GC::cubemapSize, GC::cubemapSize);
+	glRenderbufferStorage(GL_RENDERBUFFER, cubemapFormat, cubemapSize, cubemapSize);
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
+	cubemap.assign(6 * cubemapPixels, glm::vec4(0.0f));
+
+	// Each readback buffer holds all six faces.
+	glGenBuffers(GC::nCubemapReadbacks, readbackPBOs.data());
+	for(int i = 0; i < GC::nCubemapReadbacks; ++i)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackPBOs[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, cubemap.size() * sizeof(glm::vec4), 
+			nullptr, GL_STREAM_READ);
+		readbackFences[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	nextReadback = 0;
+	nPendingReadbacks = 0;
+	readbackMasks.fill(0);
+
+	dirtyFaces = 0;
+	for(int face = 0; face < 6; ++face)
+	{
+		faceCoeffts[face].assign(GC::nSHCoeffts, glm::vec3(0.0f));
+		faceEnergy[face] = 0.0f;
+		faceAge[face] = 0;
+	}
+
 	cube_pos_attrib = cubemapShader->getAttribLoc("vPos");
 	cube_decay_attrib = cubemapShader->getAttribLoc("vDecay");
 
@@ -639,20 +1365,71 @@ void AdvectParticlesSHCubemap::init()
 	glBindBuffer(GL_ARRAY_BUFFER, particles_vbo);
 	glEnableVertexAttribArray(cube_pos_attrib);
 	glEnableVertexAttribArray(cube_decay_attrib);
-	glVertexAttribPointer(cube_pos_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle),
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, pos)));
-	glVertexAttribPointer(cube_decay_attrib, 1, GL_FLOAT, GL_FALSE, sizeof(AdvectParticle), 
-		reinterpret_cast<GLvoid*>(offsetof(AdvectParticle, decay)));
+	glVertexAttribPointer(cube_pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedAdvectParticle),
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, pos)));
+	glVertexAttribPointer(cube_decay_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, decay)));
+
+	glBindVertexArray(0);
+
+	layered_pos_attrib = layeredShader->getAttribLoc("vPos");
+	layered_decay_attrib = layeredShader->getAttribLoc("vDecay");
+
+	glGenVertexArrays(1, &layered_vao);
+	glBindVertexArray(layered_vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, particles_vbo);
+	glEnableVertexAttribArray(layered_pos_attrib);
+	glEnableVertexAttribArray(layered_decay_attrib);
+	glVertexAttribPointer(layered_pos_attrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedAdvectParticle),
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, pos)));
+	glVertexAttribPointer(layered_decay_attrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAdvectParticle), 
+		reinterpret_cast<GLvoid*>(offsetof(PackedAdvectParticle, decay)));
 
 	glBindVertexArray(0);
 
+	reduction = new SHReduction(cubemapSize);
+	updateReductionScale();
+
+	splatter = new CubemapSplatter(cubemapSize, cubemapFormat == GL_RGBA8);
+	particleColors = loadImage(decayTex->filename);
+
 	saveFlag = false;
 }
 
-void AdvectParticlesSHCubemap::renderCubemap()
+void AdvectParticlesSHCubemap::renderCubemap(bool waitForFaces, bool readback,
+	int faceMask)
 {
 	if(!scene || !targetObj) return;
 
+	if(saveFlag) faceMask = allFaces;
+	bool async = asyncReadback && !saveFlag;
+	// Saving or rendering only some faces needs the separate passes.
+	// Otherwise faces not read back must be left in the layered texture.
+	bool layered = (layeredRender || !readback) && !saveFlag && faceMask == allFaces;
+	readback = readback || !layered;
+
+	// If the ring is full, the oldest frame must be collected before its
+	// buffer can be reused (it's a few frames old, so should be ready).
+	// Reading back synchronously, all older frames must be collected first.
+	while(readback && nPendingReadbacks > 0 && 
+		(!async || nPendingReadbacks == GC::nCubemapReadbacks))
+	{
+		int oldest = (nextReadback + GC::nCubemapReadbacks - nPendingReadbacks) % 
+			GC::nCubemapReadbacks;
+		if(readbackFaces(oldest, true)) continue;
+
+		// Timed out. A full ring's oldest slot is about to be reused, so 
+		//   give up on its frame rather than leave its fence pending.
+		if(async && nPendingReadbacks == GC::nCubemapReadbacks)
+		{
+			glDeleteSync(readbackFences[oldest]);
+			readbackFences[oldest] = 0;
+			--nPendingReadbacks;
+		}
+		break;
+	}
+
 	// Store current state
 	GLfloat clearCol[4];
 	GLint viewport[4];
@@ -667,76 +1444,139 @@ void AdvectParticlesSHCubemap::renderCubemap()
 
 	//Set new state
 	glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+	if(layered)
+		glBindFramebuffer(GL_FRAMEBUFFER, layeredFramebuffer);
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+	}
 
-	glViewport(0, 0, GC::cubemapSize, GC::cubemapSize);
+	glViewport(0, 0, cubemapSize, cubemapSize);
 	glDisable(GL_CULL_FACE);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
 	//Set uniforms
-	cubemapShader->setModelToWorld(modelToWorld);
-	cubemapShader->setBBTexUnit(bbTex->getTexUnit());
-	cubemapShader->setDecayTexUnit(decayTex->getTexUnit());
-	cubemapShader->setBBWidth(bbWidth);
-	cubemapShader->setBBHeight(bbHeight);
+	CubemapShader* shader = layered ? layeredShader : cubemapShader;
+	shader->setModelToWorld(getPackToWorld());
+	shader->setBBTexUnit(bbTex->getTexUnit());
+	shader->setDecayTexUnit(decayTex->getTexUnit());
+	shader->setBBWidth(bbWidth * getLightBBScale());
+	shader->setBBHeight(bbHeight * getLightBBScale());
 	glm::mat4 worldToObject = glm::inverse(
 		targetObj->getTranslation() * targetObj->getRotation());
-	cubemapShader->setWorldToObject(worldToObject);
-	cubemapShader->setAlpha(1.0f);
+	shader->setWorldToObject(worldToObject);
+	shader->setAlpha(1.0f);
 
-	cubemapShader->use();
+	shader->use();
 
-	glBindVertexArray(cube_vao);
+	if(layered)
+	{
+		// Clearing the layered framebuffer clears all six faces, then each
+		// particle is sent to every face it touches by the geometry shader.
+		glBindVertexArray(layered_vao);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDrawArrays(GL_POINTS, getFirstParticle(), getNActive());
 
-	for(int face = 0; face < 6; ++face)
+		// Layers are stored face by face, as in cubemap, so all six can be
+		// read back with a single call.
+		if(readback)
+		{
+			glActiveTexture(GL_TEXTURE0 + layeredTexUnit);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			if(async)
+			{
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackPBOs[nextReadback]);
+				glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, 0);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			}
+			else
+				glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, cubemap.data());
+		}
+	}
+	else
 	{
-		cubemapShader->setRotation(getRotation(face));
+		glBindVertexArray(cube_vao);
 
-		glClear(GL_COLOR_BUFFER_BIT);
+		for(int face = 0; face < 6; ++face)
+		{
+			if(!(faceMask & (1 << face))) continue;
 
-		glDrawArrays(GL_POINTS, 0, particles.size());
+			cubemapShader->setRotation(getRotation(face));
 
-		glPixelStorei(GL_PACK_ALIGNMENT, 1);
-		glReadPixels(0, 0, GC::cubemapSize, GC::cubemapSize, 
-			GL_RGBA, GL_FLOAT, (cubemap[face]).data());
+			glClear(GL_COLOR_BUFFER_BIT);
 
-		if(saveFlag)
-		{
-			std::string filename = "cubemap" + std::to_string((long long) face) + ".bmp";
-			
-			unsigned char* img = (unsigned char*) malloc(GC::cubemapPixels * 3);
-			unsigned char* imgFlip = (unsigned char*) malloc(GC::cubemapPixels * 3);
-
-			glReadPixels(0, 0, GC::cubemapSize, GC::cubemapSize, 
-				GL_RGB, GL_UNSIGNED_BYTE, img);
-
-			for(int r = 0; r < GC::cubemapSize; ++r)
-				for(int c = 0; c < GC::cubemapSize; ++c)
-					for(int col = 0; col < 3; ++col)
-					{
-						imgFlip[(r*GC::cubemapSize + c)*3 + col] = 
-							img[(((GC::cubemapSize-1) - r)*GC::cubemapSize + c)*3 + col];
-					}
-
-			SOIL_save_image(
-					filename.c_str(),
-					SOIL_SAVE_TYPE_BMP,
-					GC::cubemapSize, GC::cubemapSize, 3,
-					imgFlip
-				);
-
-			free(img);
-			free(imgFlip);
-
-			if(face == 5) saveFlag = false;
+			glDrawArrays(GL_POINTS, getFirstParticle(), getNActive());
+
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			if(async)
+			{
+				// Queue copy into pixel buffer, returns without waiting for GPU.
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackPBOs[nextReadback]);
+				glReadPixels(0, 0, cubemapSize, cubemapSize, 
+					GL_RGBA, GL_FLOAT, 
+					reinterpret_cast<GLvoid*>(face * cubemapPixels * sizeof(glm::vec4)));
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			}
+			else
+				glReadPixels(0, 0, cubemapSize, cubemapSize, 
+					GL_RGBA, GL_FLOAT, &cubemap[face * cubemapPixels]);
+
+			if(saveFlag)
+			{
+				std::string filename = "cubemap" + std::to_string((long long) face) + ".bmp";
+				
+				unsigned char* img = (unsigned char*) malloc(cubemapPixels * 3);
+				unsigned char* imgFlip = (unsigned char*) malloc(cubemapPixels * 3);
+
+				glReadPixels(0, 0, cubemapSize, cubemapSize, 
+					GL_RGB, GL_UNSIGNED_BYTE, img);
+
+				for(int r = 0; r < cubemapSize; ++r)
+					for(int c = 0; c < cubemapSize; ++c)
+						for(int col = 0; col < 3; ++col)
+						{
+							imgFlip[(r*cubemapSize + c)*3 + col] = 
+								img[(((cubemapSize-1) - r)*cubemapSize + c)*3 + col];
+						}
+
+				SOIL_save_image(
+						filename.c_str(),
+						SOIL_SAVE_TYPE_BMP,
+						cubemapSize, cubemapSize, 3,
+						imgFlip
+					);
+
+				free(img);
+				free(imgFlip);
+
+				if(face == 5) saveFlag = false;
+			}
 		}
 	}
 
 	glBindVertexArray(0);
 
+	if(readback && !async) dirtyFaces |= faceMask;
+
+	if(async && readback)
+	{
+		readbackFences[nextReadback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readbackMasks[nextReadback] = faceMask;
+		nextReadback = (nextReadback + 1) % GC::nCubemapReadbacks;
+		++nPendingReadbacks;
+
+		// Collect any frames which have finished, oldest first.
+		while(nPendingReadbacks > 0)
+		{
+			int oldest = (nextReadback + GC::nCubemapReadbacks - nPendingReadbacks) % 
+				GC::nCubemapReadbacks;
+			if(!readbackFaces(oldest, waitForFaces)) break;
+		}
+	}
+
 	//Restore state
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glClearColor(clearCol[0], clearCol[1], clearCol[2], clearCol[3]);
@@ -750,16 +1590,150 @@ void AdvectParticlesSHCubemap::renderCubemap()
 	glUseProgram(0);
 }
 
-void AdvectParticlesSHCubemap::updateLight()
+bool AdvectParticlesSHCubemap::readbackFaces(int slot, bool wait)
 {
-	// Set light coeffts to SH projection of cubemap.
-	light->setCoeffts(
-		SH::shProject(GC::sqrtSHSamples, GC::nSHBands,
-			[this] (float theta, float phi) -> glm::vec3
+	const GLuint64 timeout = 1000000000; // 1s, in ns.
+
+	GLenum status = glClientWaitSync(readbackFences[slot], 
+		GL_SYNC_FLUSH_COMMANDS_BIT, wait ? timeout : 0);
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+
+	glDeleteSync(readbackFences[slot]);
+	readbackFences[slot] = 0;
+	--nPendingReadbacks;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackPBOs[slot]);
+	const glm::vec4* faces = static_cast<const glm::vec4*>(glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER, 0, cubemap.size() * sizeof(glm::vec4), GL_MAP_READ_BIT));
+	if(faces)
+	{
+		for(int face = 0; face < 6; ++face)
+			if(readbackMasks[slot] & (1 << face))
+				std::copy(faces + face*cubemapPixels, faces + (face+1)*cubemapPixels,
+					cubemap.begin() + face*cubemapPixels);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		dirtyFaces |= readbackMasks[slot];
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	return true;
+}
+
+std::vector<glm::vec3> AdvectParticlesSHCubemap::splatCubemap()
+{
+	if(!targetObj) return std::vector<glm::vec3>(GC::nSHCoeffts, glm::vec3(0.0f));
+
+	glm::mat4 toTarget = glm::inverse(
+		targetObj->getTranslation() * targetObj->getRotation()) * modelToWorld;
+
+	splatter->splat(particles.data(), getNActive(), toTarget, 
+		bbWidth * getLightBBScale(), bbHeight * getLightBBScale(), 
+		particleColors, clearColor);
+
+	return splatter->project();
+}
+
+int AdvectParticlesSHCubemap::chooseFaces()
+{
+	/* Faces are ranked oldest first, or with prioritizeEnergy by the light 
+	 * they held when last seen, scaled by age so dim faces still get a turn.
+	 * Faces at maxFaceAge always come first.
+	 */
+	std::array<float, 6> priority;
+	for(int face = 0; face < 6; ++face)
+	{
+		float age = static_cast<float>(faceAge[face]);
+		if(faceAge[face] >= maxFaceAge)
+			priority[face] = 1e30f * (1.0f + age);
+		else if(prioritizeEnergy)
+			priority[face] = (faceEnergy[face] + EPS) * (1.0f + age);
+		else
+			priority[face] = age;
+	}
+
+	std::array<int, 6> order = {0, 1, 2, 3, 4, 5};
+	std::stable_sort(order.begin(), order.end(),
+		[&priority] (int a, int b)
+		{
+			return priority[a] > priority[b];
+		});
+
+	int nFaces = std::min(std::max(facesPerFrame, 1), 6);
+	int mask = 0;
+	for(int i = 0; i < nFaces; ++i)
+		mask |= 1 << order[i];
+
+	for(int face = 0; face < 6; ++face)
+		faceAge[face] = (mask & (1 << face)) ? 0 : faceAge[face] + 1;
+
+	return mask;
+}
+
+std::vector<glm::vec3> AdvectParticlesSHCubemap::projectDirtyFaces()
+{
+	for(int face = 0; face < 6; ++face)
+	{
+		if(!(dirtyFaces & (1 << face))) continue;
+
+		std::fill(faceCoeffts[face].begin(), faceCoeffts[face].end(), glm::vec3(0.0f));
+		projectFace(&cubemap[face * cubemapPixels], cubemapSize, face, 
+			faceCoeffts[face].data());
+
+		glm::vec3 dc = faceCoeffts[face][0];
+		faceEnergy[face] = dc.x + dc.y + dc.z;
+	}
+	dirtyFaces = 0;
+
+	std::vector<glm::vec3> coeffts(GC::nSHCoeffts, glm::vec3(0.0f));
+	for(int face = 0; face < 6; ++face)
+		for(int c = 0; c < GC::nSHCoeffts; ++c)
+			coeffts[c] += faceCoeffts[face][c];
+	return coeffts;
+}
+
+void AdvectParticlesSHCubemap::projectFace(
+	const glm::vec4* texels, int faceSize, int face, glm::vec3* coeffts)
+{
+	const float texelSize = 2.0f / faceSize;
+	float basis[GC::nSHCoeffts];
+
+	for(int r = 0; r < faceSize; ++r)
+		for(int c = 0; c < faceSize; ++c)
+		{
+			glm::vec3 color(texels[r*faceSize + c]);
+			if(color == glm::vec3(0.0f)) continue;
+
+			// Inverse of the mapping in cubemapLookup().
+			float s = (c + 0.5f) * texelSize - 1.0f;
+			float t = (r + 0.5f) * texelSize - 1.0f;
+			glm::vec3 dir;
+			switch(face)
 			{
-				return this->cubemapLookup(theta, phi);
+			case 0:  dir = glm::vec3( 1.0f,     t,    -s); break;
+			case 1:  dir = glm::vec3(-1.0f,    -t,    -s); break;
+			case 2:  dir = glm::vec3(    s,  1.0f,    -t); break;
+			case 3:  dir = glm::vec3(   -s, -1.0f,    -t); break;
+			case 4:  dir = glm::vec3(    s,     t,  1.0f); break;
+			default: dir = glm::vec3(    s,    -t, -1.0f); break;
 			}
-	));
+
+			// Solid angle subtended by the texel.
+			float distSq = 1.0f + s*s + t*t;
+			float solidAngle = texelSize * texelSize / (distSq * sqrt(distSq));
+			SH::evalBasis(GC::nSHBands, dir / sqrt(distSq), basis);
+
+			color *= solidAngle;
+			for(int i = 0; i < GC::nSHCoeffts; ++i)
+				coeffts[i] += color * basis[i];
+		}
+}
+
+std::vector<glm::vec3> AdvectParticlesSHCubemap::projectCubemap()
+{
+	// Integrate every face, as the amortized path does, so the two agree.
+	dirtyFaces = allFaces;
+	return projectDirtyFaces();
 }
 
 glm::vec3 AdvectParticlesSHCubemap::cubemapLookup(float theta, float phi)
@@ -806,10 +1780,10 @@ glm::vec3 AdvectParticlesSHCubemap::cubemapLookup(float theta, float phi)
 	t = (t + 1.0f) / 2.0f;
 
 	//Find integer pixel coords:
-	int s_p = static_cast<int>(s * (GC::cubemapSize-1));
-	int t_p = static_cast<int>(t * (GC::cubemapSize-1));
+	int s_p = static_cast<int>(s * (cubemapSize-1));
+	int t_p = static_cast<int>(t * (cubemapSize-1));
 
-	return glm::vec3(cubemap[face][s_p + t_p*GC::cubemapSize]);
+	return glm::vec3(cubemap[face*cubemapPixels + s_p + t_p*cubemapSize]);
 }
 
 int AdvectParticlesSHCubemap::findFace(glm::vec3 dir)
@@ -844,3 +1818,250 @@ glm::mat4 AdvectParticlesSHCubemap::getRotation(int face)
 		return glm::mat4(1.0f);
 	else return glm::mat4(0.0f); //fallback
 }
+
+AdvectParticlesSHAnalytic::AdvectParticlesSHAnalytic(
+	Renderable* targetObj,
+	int maxParticles, ParticleShader* shader, 
+	float intensity,
+	Texture* bbTex, Texture* decayTex)
+	:AdvectParticles(maxParticles, shader, bbTex, decayTex),
+	 light(nullptr), amb(nullptr),
+	 clearColor(glm::vec4(0.0f)), ambColor(glm::vec4(0.0f)),
+	 targetObj(targetObj), intensity(intensity), ambIntensity(0.0f)
+{
+	particleColors = loadImage(decayTex->filename);
+}
+
+void AdvectParticlesSHAnalytic::update(int dTime)
+{
+	AdvectParticles::update(dTime);
+	if(!light) return;
+	filter.update(dTime, light, 
+		[this] () -> std::vector<glm::vec3>
+		{
+			return this->projectLight();
+		});
+}
+
+void AdvectParticlesSHAnalytic::onAdd()
+{
+	light = scene->add(new SHLight(
+			[] (float theta, float phi) -> glm::vec3
+			{
+				return glm::vec3(0.0f);
+			}));
+
+	amb = scene->add(new SHLight(
+			[this] (float theta, float phi) -> glm::vec3
+			{
+				return glm::vec3(ambColor);
+			}));
+
+	if(light == nullptr || amb == nullptr)
+		std::cout << "Warning: SH lights could not all be added.\n"; 
+	else
+	{
+		light->setIntensity(intensity);
+		amb->setIntensity(ambIntensity);
+		filter.reset();
+		light->setCoeffts(projectLight());
+	}
+}
+
+void AdvectParticlesSHAnalytic::onRemove()
+{
+	if(light) scene->remove(light);
+	if(amb) scene->remove(amb);
+}
+
+void AdvectParticlesSHAnalytic::setIntensity(float intensity)
+{
+	this->intensity = intensity;
+	light->setIntensity(intensity);
+}
+
+void AdvectParticlesSHAnalytic::setAmbIntensity(float ambIntensity)
+{
+	this->ambIntensity = ambIntensity;
+	amb->setIntensity(ambIntensity);
+}
+
+std::vector<glm::vec3> AdvectParticlesSHAnalytic::projectLight()
+{
+	if(!targetObj) return std::vector<glm::vec3>(GC::nSHCoeffts, glm::vec3(0.0f));
+
+	glm::mat4 toTarget = glm::inverse(
+		targetObj->getTranslation() * targetObj->getRotation()) * modelToWorld;
+
+	std::vector<glm::vec3> coeffts = projectParticles(
+		particles.data(), getNActive(),
+		toTarget, 0.5f * sqrt(bbWidth * bbHeight) * getLightBBScale(), particleColors);
+
+	// Background colour is constant, so only contributes to the DC term.
+	coeffts[0] += glm::vec3(clearColor) * (2.0f * sqrt(PI));
+
+	return coeffts;
+}
+
+std::vector<glm::vec3> AdvectParticlesSHAnalytic::projectParticles(
+	const AdvectParticle* particles, int n,
+	const glm::mat4& toTarget, float bbRadius,
+	const std::vector<glm::vec4>& colors)
+{
+	const int nCoeffts = GC::nSHCoeffts;
+
+	// Per-thread accumulators, stored as separate r, g, b arrays so the 
+	// inner loops over coeffts vectorize.
+	int nThreads = omp_get_max_threads();
+	std::vector<float> partial(nThreads * 3 * nCoeffts, 0.0f);
+
+	#pragma omp parallel
+	{
+		float* accR = &partial[omp_get_thread_num() * 3 * nCoeffts];
+		float* accG = accR + nCoeffts;
+		float* accB = accG + nCoeffts;
+
+		float basis[GC::nSHCoeffts];
+		float zonal[GC::nSHBands];
+		float weight[GC::nSHCoeffts];
+
+		#pragma omp for
+		for(int i = 0; i < n; ++i)
+		{
+			/* FireLight.glsl discards fragments with fade^3 * decayIntensity < 0.05,
+			 * where fade = 1 - r^2, and draws the rest at (nearly) full colour.
+			 * So the visible part of a billboard is a disk of radius rMax.
+			 */
+			float decay = particles[i].decay;
+			float decayIntensity = decay < 0.3f ? decay : (1.0f - decay);
+			if(decayIntensity <= 0.05f) continue;
+
+			float rMax = bbRadius * sqrt(1.0f - pow(0.05f / decayIntensity, 1.0f / 3.0f));
+
+			glm::vec3 pos(toTarget * particles[i].pos);
+			float dist = glm::length(pos);
+			if(dist <= rMax) continue; // Receiver is inside the billboard.
+
+			glm::vec3 dir = pos / dist;
+			float sinAngle = rMax / dist;
+			float cosAngle = sqrt(1.0f - sinAngle*sinAngle);
+
+			SH::evalBasis(GC::nSHBands, dir, basis);
+			SH::capZonal(GC::nSHBands, cosAngle, zonal);
+
+			int pixel = static_cast<int>(decay * (colors.size()-1));
+			glm::vec3 color = glm::clamp(glm::vec3(colors[pixel]), 
+				glm::vec3(0.9f), glm::vec3(1.0f));
+
+			for(int l = 0; l < GC::nSHBands; ++l)
+				for(int c = l*l; c < (l+1)*(l+1); ++c)
+					weight[c] = zonal[l] * basis[c];
+
+			for(int c = 0; c < nCoeffts; ++c)
+			{
+				accR[c] += color.x * weight[c];
+				accG[c] += color.y * weight[c];
+				accB[c] += color.z * weight[c];
+			}
+		}
+	}
+
+	std::vector<glm::vec3> coeffts(nCoeffts, glm::vec3(0.0f));
+	for(int t = 0; t < nThreads; ++t)
+	{
+		const float* accR = &partial[t * 3 * nCoeffts];
+		for(int c = 0; c < nCoeffts; ++c)
+			coeffts[c] += glm::vec3(
+				accR[c], accR[c + nCoeffts], accR[c + 2*nCoeffts]);
+	}
+
+	return coeffts;
+}
+
+AdvectParticlesSHProbes::AdvectParticlesSHProbes(
+	SHProbeVolume* probes,
+	float intensity,
+	int maxParticles, ParticleShader* shader,
+	Texture* bbTex, Texture* decayTex)
+	:AdvectParticles(maxParticles, shader, bbTex, decayTex),
+	 probes(probes), intensity(intensity)
+{
+	particleColors = loadImage(decayTex->filename);
+}
+
+void AdvectParticlesSHProbes::update(int dTime)
+{
+	AdvectParticles::update(dTime);
+	findEmitters();
+	probes->refresh(
+		[this] (const glm::vec3& pos, glm::vec3* coeffts)
+		{
+			this->projectProbe(pos, coeffts);
+		});
+}
+
+void AdvectParticlesSHProbes::onAdd()
+{
+	findEmitters();
+	probes->refreshAll(
+		[this] (const glm::vec3& pos, glm::vec3* coeffts)
+		{
+			this->projectProbe(pos, coeffts);
+		});
+}
+
+void AdvectParticlesSHProbes::findEmitters()
+{
+	// World space positions & radiant intensities are shared by all probes
+	// refreshed this frame, so find them once up front.
+	int n = getNActive();
+	emitterPos.resize(n);
+	emitterColor.resize(n);
+
+	float lightScale = getLightBBScale();
+	float area = bbWidth * bbHeight * lightScale * lightScale * intensity;
+
+	for(int i = 0; i < n; ++i)
+	{
+		float decay = particles[i].decay;
+		float decayIntensity = decay < 0.3f ? decay : (1.0f - decay);
+
+		emitterPos[i] = glm::vec3(modelToWorld * particles[i].pos);
+		emitterColor[i] = getParticleColor(decay) * (decayIntensity * area);
+	}
+}
+
+void AdvectParticlesSHProbes::projectProbe(
+	const glm::vec3& probePos, glm::vec3* coeffts)
+{
+	// Closest distance considered, so probes inside the fire don't blow up.
+	const float minDistSq = 0.25f * bbWidth * bbHeight;
+
+	float basis[GC::nSHCoeffts];
+
+	std::fill(coeffts, coeffts + GC::nSHCoeffts, glm::vec3(0.0f));
+
+	for(size_t i = 0; i < emitterPos.size(); ++i)
+	{
+		glm::vec3 toParticle = emitterPos[i] - probePos;
+		float distSq = glm::dot(toParticle, toParticle);
+		if(distSq < EPS) continue;
+
+		// Billboard subtends (approx.) area / distSq steradians.
+		glm::vec3 radiance = emitterColor[i] / std::max(distSq, minDistSq);
+
+		SH::evalBasis(GC::nSHBands, toParticle / sqrt(distSq), basis);
+
+		for(int c = 0; c < GC::nSHCoeffts; ++c)
+			coeffts[c] += radiance * basis[c];
+	}
+}
+
+glm::vec3 AdvectParticlesSHProbes::getParticleColor(float decay)
+{
+	int pixel = static_cast<int>(decay * (particleColors.size()-1));
+	return glm::vec3(
+			saturate(particleColors[pixel].x, minColor),
+			saturate(particleColors[pixel].y, minColor),
+			saturate(particleColors[pixel].z, minColor));
+}
@@ -3,18 +3,32 @@
 
 #include "Renderable.hpp"
 #include "Shader.hpp"
+#include "SHFilter.hpp"
 #include "GC.hpp"
+#include "AlignedAllocator.hpp"
 
 #include <GL/glew.h>
 #include <glm.hpp>
 
 #include <vector>
 #include <array>
+#include <random>
 
 class Texture;
 class PhongLight;
 class SHLight;
 class ParticleShader;
+class SHProbeVolume;
+class SHReduction;
+class CubemapSplatter;
+class StreamBuffer;
+class ParticleBatch;
+class ForceField;
+class FluidSolver;
+class MeshSDF;
+class MeshEmitter;
+class ParticleRecorder;
+class ParticleReplay;
 
 /* ParticleSystem
  * An ADT for a renderable object which is a particle system.
@@ -27,6 +41,7 @@ public:
 	ParticleShader* getParticleShader() {return shader;};
 	Shader* getShader() {return static_cast<Shader*>(shader);};
 	virtual void setShader(ParticleShader* shader) = 0;
+	float getAlpha() const {return alpha;};
 protected:
 	int maxParticles;
 	float alpha;
@@ -40,6 +55,19 @@ struct AdvectParticle
 	GLfloat randTex;
 };
 
+/* PackedAdvectParticle
+ * The 8 byte vertex format AdvectParticles are streamed to the GPU in. 
+ * pos is quantized to 16 bits per axis within the bounds of that frame's
+ *   particles, & decay & randTex to 8 bits, all read as normalized [0, 1]
+ *   attribs. getPackToWorld() maps the unit box back to world space.
+ */
+struct PackedAdvectParticle
+{
+	GLushort pos[3];
+	GLubyte decay;
+	GLubyte randTex;
+};
+
 
 /* AdvectParticles
  * A ParticleSystem consisting of MaxParticles particles, which behave as follows:
@@ -56,18 +84,72 @@ struct AdvectParticle
  * **Note** that scrollTexParticles.glsl uses bbTex in a different way. See the shader source for more details.
  * The additive property determines whether additive or subtractive alpha 
  *   blending is used.
+ * Simulation state is held as aligned structure-of-arrays, updated simdWidth
+ *   particles at a time (with AVX2 where available), then packed into 
+ *   particles for derived classes to read, and straight into a StreamBuffer
+ *   as PackedAdvectParticles for rendering.
+ * The simulation runs in fixed steps of simStep ms, however long each frame
+ *   is. Leftover time carries over to the next update(), and if interpolate
+ *   is set, particles are drawn between their last two simulated positions.
+ * If frameBudget is set, the number of active particles is scaled between
+ *   minParticles & maxParticles to keep update() & render() within it.
+ *   Fewer particles are drawn larger & more opaque, keeping a similar density.
+ * If lodSize is set, fires which are small on screen use fewer particles &
+ *   longer simulation steps. See below.
  */
 class AdvectParticles : public ParticleSystem
 {
 public:
 	AdvectParticles(int maxParticles, ParticleShader* shader,
 		Texture* bbTex, Texture* decayTex, bool texScrolls = true, bool additive = true);
+	virtual ~AdvectParticles();
 
 	void render();
 	virtual void update(int dTime);
 	virtual void setShader(ParticleShader* shader);
+	const std::vector<AdvectParticle>& getParticles() const {return particles;};
+	// Takes packed positions (in the unit box) to world space.
+	glm::mat4 getPackToWorld() const;
+
+	// Points to the batch rendering this emitter (nullptr if it renders itself).
+	ParticleBatch* batch;
 
 	glm::vec4 extForce; //External force applied to all particles.
+	// World space force field, sampled at each particle (nullptr for none).
+	ForceField* forceField;
+	/* Fluid carrying the particles (nullptr for none). Each particle's 
+	 *   velocity is pulled towards the fluid's at a rate of fluidDrag per ms.
+	 */
+	FluidSolver* fluid;
+	float fluidDrag;
+
+	/* A mesh particles collide with, as the signed distance field sdf of 
+	 *   object's mesh. Particles are kept radius away from the surface (in
+	 *   object's model space). Velocity into the surface is reflected, scaled 
+	 *   by bounce, and velocity along it is scaled by (1 - friction), so 
+	 *   particles slide over the mesh.
+	 */
+	struct Collider
+	{
+		const MeshSDF* sdf;
+		Renderable* object;
+		float radius;
+		float bounce;
+		float friction;
+	};
+	std::vector<Collider> colliders;
+
+	/* If set, particles spawn on the surface of emitter's mesh, moving out
+	 *   along its normal at initVel, instead of in a disk of baseRadius.
+	 */
+	MeshEmitter* emitter;
+
+	/* If recorder is set, each update()'s particles are recorded to it. If
+	 *   replay is set, update() plays the next frame from it instead of 
+	 *   simulating, so lights & rendering get identical input every run.
+	 */
+	ParticleRecorder* recorder;
+	ParticleReplay* replay;
 
 	float height;
 
@@ -84,42 +166,174 @@ public:
 	glm::vec3 cameraDir;
 	float bbHeight; //Particle billboard width.
 	float bbWidth;  //Particle billboard height.
+
+	int simStep;     // Length of each simulation step (ms).
+	int maxSubsteps; // Most steps taken in one update(), extra time is dropped.
+	bool interpolate;
+
+	float frameBudget; // Target update + render time (ms), 0 for a fixed count.
+	int minParticles;
+
+	/* Level of detail. The fire's projected size is the height of a sphere of
+	 *   lodRadius around its origin as a fraction of the screen height, seen
+	 *   from the scene's camera. Below lodSize (0 to disable), the particle 
+	 *   count falls with projected area, down to minParticles, and steps grow
+	 *   to as much as lodMaxStepScale * simStep. frameBudget may lower the 
+	 *   count further.
+	 */
+	float lodSize;
+	float lodRadius;
+	int lodMaxStepScale;
+	float getProjectedSize();
+	int getNActive() const {return nActive;};
+	// Alpha & billboard scale to draw with, compensating for inactive particles.
+	float getDrawAlpha() const;
+	float getDrawBBScale() const;
+	/* Billboard scale for lighting, keeping nActive * bbArea constant so 
+	 *   fewer particles give off the same light.
+	 */
+	float getLightBBScale() const;
+	// Set by a batch drawing this emitter, to its share of the draw time.
+	void setBatchRenderTime(float time) {renderTime = time;};
 protected:
 	bool additive;
 	std::vector<AdvectParticle> particles;
 	int randi(int low, int high);
 	float randf(float low, float high);
+	/* Generators for picking spawn points on emitter, one per thread as
+	 *   particles are spawned in parallel.
+	 */
+	std::vector<std::mt19937> spawnRNGs;
+	void seedSpawnRNGs();
 
 	std::vector<glm::vec4> loadImage(const std::string& filename);
 	float saturate(float val, float min);
 
 	GLuint vao;
-	GLuint particles_vbo;
+	StreamBuffer* particleStream;
+	GLuint particles_vbo; // particleStream's buffer.
+	// First vertex of the current particles in particles_vbo.
+	GLint getFirstParticle() const;
+	/* Whether anything besides the emitter itself draws from particleStream,
+	 *   so it must still be filled while the emitter is in a batch.
+	 */
+	virtual bool needsOwnStream() const {return false;};
 	GLuint pos_attrib;
 	GLuint decay_attrib;
 	GLuint randTex_attrib;
 
 	Texture* bbTex;
 	Texture* decayTex;
+
+	/* Light statistics, gathered while particles are packed in update(), so 
+	 *   no second pass over the particles is needed to place lights.
+	 * Each particle assigned to a light adds its position & its colour 
+	 *   (looked up in colors by decay, & scaled by its fade in/out if 
+	 *   weightByDecay) to that light's sums. Sums are per thread, then 
+	 *   added together once the update is done.
+	 * With clustering on, assignments are ignored & each particle is instead 
+	 *   given to the light with the nearest centroid from the previous update,
+	 *   i.e. one step of k-means per update, warm started from the last.
+	 *   This gives stable lights, spread out to cover the whole fire.
+	 */
+	struct LightStats
+	{
+		glm::vec4 posSum;
+		glm::vec4 colorSum;
+		int count;
+	};
+	void initLightStats(int nLights, const std::vector<glm::vec4>& colors, bool weightByDecay);
+	void assignLight(int particle, int light);
+	void clearLightAssignments();
+	void setLightClustering(bool clustering);
+	bool getLightClustering() const {return clusterLights;};
+	const LightStats& getLightStats(int light) const {return lightStats[light];};
 private:
-	std::vector<glm::vec4> vel;
-	std::vector<glm::vec4> acn;
+	typedef std::vector<float, AlignedAllocator<float, 32>> FloatArray;
+	typedef std::vector<int, AlignedAllocator<int, 32>> IntArray;
+	static const int simdWidth = 8;
+
+	FloatArray posX, posY, posZ;
+	FloatArray prevX, prevY, prevZ; // Positions before the last step.
+	FloatArray velX, velY, velZ;
+	FloatArray acnX, acnY, acnZ;
+	FloatArray decay;
+	FloatArray randTex;
 
-	std::vector<int> time;
-	std::vector<int> lifeTime;
-	std::vector<int> perturbCounter;
-	std::vector<int> perturbTime;
+	IntArray time;
+	IntArray lifeTime;
+	IntArray perturbCounter;
+	IntArray perturbTime;
+
+	IntArray statLight; // Light each particle is assigned to, or -1.
+	std::vector<glm::vec4> statColors;
+	bool statWeightByDecay;
+	std::vector<LightStats> lightStats;
+	std::vector<LightStats> threadStats; // nThreads * lightStats.size()
+	bool clusterLights;
+	std::vector<glm::vec4> clusterCenters;
+	int nearestCluster(const glm::vec4& pos) const;
+	void updateClusters();
 
 	bool perturbOn;
 	bool initPerturb;
+	int accumulator; // Simulation time not yet stepped (ms).
+
+	int nActive; // Particles [0, nActive) are simulated & drawn.
+	float updateTime; // Duration of the last update() & render() (ms).
+	float renderTime;
+	float avgCost;
+	int lodStepScale;
+	// Returns the most particles to use, & sets lodStepScale.
+	int findLODCount();
+	void adaptParticleCount(int maxCount);
+	// Moves nActive a little towards target, so changes fade in.
+	void moveNActiveTowards(int target);
+	void setNActive(int n);
+	void playFrame();
 
-	void updateParticle(int index, int dTime);
+	void step(int dTime);
+	/* Update particles [first, first + count). The AVX2 version always 
+	 *   updates simdWidth particles. Spawning & perturbation are found for
+	 *   the whole block with masks, then handled one particle at a time.
+	 */
+	void updateBlock(int first, int count, int dTime);
+	/* Applies forceField & fluid to the velocities of particles 
+	 *   [first, first + count), which is at most simdWidth particles.
+	 * toWorld takes model to world space, toModel rotates vectors back.
+	 */
+	void applyFields(int first, int count, float dt,
+		const glm::mat4& toWorld, const glm::mat3& toModel);
+	/* Collides particles [first, first + count) with each of colliders. */
+	void collideBlock(int first, int count);
+	std::vector<glm::mat4> colliderToObject; // Found for each collider by step().
+	std::vector<glm::mat4> colliderFromObject;
+#ifdef __AVX2__
+	void updateBlockAVX2(int first, int dTime);
+#endif
+	/* Writes particles [first, first + count) to particles & out, at 
+	 *   fraction t of the way from their previous to their current positions.
+	 * Positions are quantized to out within packMin & packScale. If copy is
+	 *   not nullptr, packed particles are also written to it.
+	 */
+	void packBlock(int first, int count, float t, PackedAdvectParticle* out, 
+		PackedAdvectParticle* copy, LightStats* stats);
+	void packAll(float t);
+	/* Sets packMin & packScale to bound particles [0, nActive). Bounding
+	 *   both the previous & current positions bounds any interpolated ones.
+	 */
+	void findPackBounds();
+	glm::vec3 packMin;
+	glm::vec3 packScale; // Extent of the bounds (never 0).
+	std::vector<glm::vec3> threadBounds; // Min & max for each thread.
 	void spawnParticle(int index);
+	void perturbParticle(int index);
 	void init(Texture* bbTex, Texture* decayTex, bool texScrolls);
-	glm::vec4 getInitVel(const glm::vec4& pos);
+	glm::vec4 getInitVel(const glm::vec4& outward);
 
 	glm::vec4 perturb(glm::vec4 input);
-	glm::vec4 randInitPos();
+	// Returns a spawn position, and sets outward to the direction to move in.
+	glm::vec4 randInitPos(glm::vec4& outward);
 };
 
 /* AdvectParticlesLights
@@ -141,16 +355,19 @@ public:
 protected:
 	virtual void updateLights() = 0;
 	glm::vec4 getParticleColor(float decay);
+	float getLightIntensity() const {return lightIntensity;};
 	std::vector<glm::vec4> particleColors;
+	static const float minColor;
 private:
 	static const float specIntensity;
 	float lightIntensity;
-	static const float minColor;
 };
 
 /* AdvectParticlesCentroidLights
  * Similar approach to AdvectParticlesRandLights, but each light is placed at the 
  * centroid of "clumpSize" particles.
+ * Centroids & colours are gathered during the particle update (see 
+ * AdvectParticles::LightStats).
  */
 class AdvectParticlesCentroidLights : public AdvectParticlesLights
 {
@@ -160,6 +377,9 @@ public:
 		int _interval, ParticleShader* _shader, 
 		Texture* _bbTex, Texture* _decayTex);
 	const int clumpSize;
+	// Place lights by clustering all particles, rather than by random clumps.
+	void setClustering(bool clustering) {setLightClustering(clustering);};
+	bool getClustering() const {return getLightClustering();};
 protected:
 	void updateLights();
 private:
@@ -167,9 +387,6 @@ private:
 	const int interval;
 	void init();
 	void randomizeClumps();
-	std::vector<std::vector<int>> clumps;
-	glm::vec4 getParticleCentroid(const std::vector<int>& clump);
-	glm::vec4 getAverageColor(const std::vector<int>& clump);
 };
 
 /* AdvectParticlesSHLights
@@ -198,13 +415,15 @@ protected:
 	Renderable* targetObj;
 	std::vector<glm::vec4> particleColors;
 	glm::vec3 getParticleColor(float decay);
+	static const float minColor;
 private:
 	float intensity;
-	static const float minColor;
 };
 
 /* AdvectParticlesCentroidSHLights
  * Copy of AdvectParticlesCentroidLights for SH lights.
+ * Lights are moved with pointAt() & setColor() every update, so there is
+ *   no SHFilter; interval is the only control on how often clumps change.
  */
 class AdvectParticlesCentroidSHLights : public AdvectParticlesSHLights
 {
@@ -215,6 +434,9 @@ public:
 		int _interval, ParticleShader* _shader, 
 		Texture* _bbTex, Texture* _decayTex);
 	const int clumpSize;
+	// Place lights by clustering all particles, rather than by random clumps.
+	void setClustering(bool clustering) {setLightClustering(clustering);};
+	bool getClustering() const {return getLightClustering();};
 protected:
 	void updateLights();
 private:
@@ -222,9 +444,6 @@ private:
 	const int interval;
 	void init();
 	void randomizeClumps();
-	std::vector<std::vector<int>> clumps;
-	glm::vec4 getParticleCentroid(const std::vector<int>& clump);
-	glm::vec3 getAverageColor(const std::vector<int>& clump);
 };
 
 /* AdvectParticlesCentroidSHLights
@@ -233,41 +452,206 @@ private:
 class AdvectParticlesSHCubemap : public AdvectParticles
 {
 public:
+	/* cubemapSize is the width of each face in texels, and cubemapFormat the
+	 *   internal format faces are rendered in (e.g. GL_RGBA8, GL_RGBA16F, 
+	 *   GL_RGBA32F, GL_R11F_G11F_B10F). 5 band SH needs very little 
+	 *   resolution, so small faces (e.g. 32) save a lot of fill and readback.
+	 * Float formats don't saturate where billboards overlap, so give brighter
+	 *   light than GL_RGBA8 at the same intensity.
+	 */
 	AdvectParticlesSHCubemap(
 		Renderable* targetObj,
 		int _maxParticles, ParticleShader* _shader, 
 		float intensity,
-		Texture* _bbTex, Texture* _decayTex);
+		Texture* _bbTex, Texture* _decayTex,
+		int cubemapSize = GC::cubemapSize,
+		GLenum cubemapFormat = GL_RGBA8);
 	void update(int dTime);
 	void onAdd();
+	void onRemove();
 	void saveCubemap();
 	void setIntensity(float intensity);
 	void setAmbIntensity(float ambIntensity);
 	float getIntensity() {return intensity;}
+	/* If gpuProjection is set, the cubemap is projected onto SH by an 
+	 *   SHReduction and added to the SHBlock on the GPU, so it is never read
+	 *   back. light then holds zero coeffts, and filter is not used.
+	 */
+	void setGPUProjection(bool gpuProjection);
+	bool getGPUProjection() {return gpuProjection;};
+	/* Renders the cubemap and projects it on both CPU and GPU, returning the
+	 *   largest difference in any coefft relative to the size of the DC term.
+	 */
+	float compareProjections();
 	SHLight* light;
 	SHLight* amb;
 	glm::vec4 clearColor;
 	glm::vec4 ambColor;
+	SHFilter filter; // Controls how often the cubemap is re-rendered.
+	/* If true, faces are read back via a ring of pixel buffers, so lighting
+	 *   lags rendering by a frame or two but the CPU never waits on the GPU.
+	 */
+	bool asyncReadback;
+	/* If true, all six faces are rendered in a single draw call into a layered
+	 *   framebuffer, rather than in a separate pass per face.
+	 */
+	bool layeredRender;
+	/* If true, the cubemap is splatted on the CPU by a CubemapSplatter 
+	 *   rather than rendered with GL.
+	 */
+	bool softwareSplat;
+	/* If facesPerFrame is less than 6, only that many faces are re-rendered
+	 *   each update, oldest first, and the SH is summed from a projection of
+	 *   each face, so only the new faces need projecting.
+	 * With prioritizeEnergy, faces holding more of the fire's light are 
+	 *   refreshed more often. Either way no face goes more than maxFaceAge
+	 *   updates without a refresh (if maxFaceAge >= 6 / facesPerFrame).
+	 */
+	int facesPerFrame;
+	bool prioritizeEnergy;
+	int maxFaceAge;
+	/* Rotation taking object space to the view space of each face. */
+	static glm::mat4 getRotation(int face);
+	/* Adds the SH projection of one face (faceSize * faceSize texels, laid
+	 *   out as read back from GL) to coeffts, integrating over every texel.
+	 */
+	static void projectFace(const glm::vec4* texels, int faceSize, int face,
+		glm::vec3* coeffts);
+protected:
+	// Cubemap faces are drawn from particleStream.
+	bool needsOwnStream() const {return true;};
 private:
 	Renderable* targetObj;
 	CubemapShader* cubemapShader;
+	CubemapShader* layeredShader;
 	void init();
-	void renderCubemap();
-	void updateLight();
-	std::array<std::array<glm::vec4, GC::cubemapPixels>, 6> cubemap;
+	// Sets the SHReduction's scale from intensity & light's colour.
+	void updateReductionScale();
+	/* If readback is false the faces are left on the GPU, in the layered
+	 *   texture, for the SHReduction.
+	 */
+	void renderCubemap(bool waitForFaces = false, bool readback = true,
+		int faceMask = allFaces);
+	bool readbackFaces(int slot, bool wait);
+	// Projects all six faces with projectFace(), refreshing faceCoeffts.
+	std::vector<glm::vec3> projectCubemap();
+	const int cubemapSize;
+	const int cubemapPixels;
+	const GLenum cubemapFormat;
+	std::vector<glm::vec4> cubemap; // Faces stored one after another.
 	glm::vec3 cubemapLookup(float theta, float phi);
 	int findFace(glm::vec3 dir);
 	glm::vec3 shEval(int face, int texel, int coefft);
-	glm::mat4 getRotation(int face);
+	std::vector<glm::vec3> splatCubemap();
+	int chooseFaces();
+	std::vector<glm::vec3> projectDirtyFaces();
+	static const int allFaces = 0x3f; // Bit mask of all six faces.
 	GLuint renderbuffer;
 	GLuint framebuffer;
+	std::array<GLuint, GC::nCubemapReadbacks> readbackPBOs;
+	std::array<GLsync, GC::nCubemapReadbacks> readbackFences;
+	int nextReadback; // Slot the next frame is read back into.
+	int nPendingReadbacks;
+	std::array<int, GC::nCubemapReadbacks> readbackMasks; // Faces in each frame.
+	int dirtyFaces; // Faces read back but not yet projected.
+	std::array<std::vector<glm::vec3>, 6> faceCoeffts;
+	std::array<float, 6> faceEnergy;
+	std::array<int, 6> faceAge;
 	GLuint cube_vao;
 	GLuint cube_pos_attrib;
 	GLuint cube_decay_attrib;
+	GLuint layeredTex;
+	GLuint layeredTexUnit;
+	GLuint layeredFramebuffer;
+	GLuint layered_vao;
+	GLuint layered_pos_attrib;
+	GLuint layered_decay_attrib;
+	SHReduction* reduction;
+	CubemapSplatter* splatter;
+	std::vector<glm::vec4> particleColors;
+	bool gpuProjection;
 	bool saveFlag;
 	float intensity;
 	float ambIntensity;
 	static const glm::mat4 turnAround; //Rotation of PI about y-axis.
 };
 
+/* AdvectParticlesSHAnalytic
+ * Alternative to AdvectParticlesSHCubemap which needs no render pass or 
+ *   readback. Each particle, seen from targetObj's origin, is projected 
+ *   directly into SH as a spherical cap the size of the visible part of its
+ *   billboard, with the colour FireLight.glsl would give it.
+ * The projection runs entirely on the CPU (see projectParticles()).
+ */
+class AdvectParticlesSHAnalytic : public AdvectParticles
+{
+public:
+	AdvectParticlesSHAnalytic(
+		Renderable* targetObj,
+		int maxParticles, ParticleShader* shader, 
+		float intensity,
+		Texture* bbTex, Texture* decayTex);
+	void update(int dTime);
+	void onAdd();
+	void onRemove();
+	void setIntensity(float intensity);
+	void setAmbIntensity(float ambIntensity);
+	float getIntensity() {return intensity;}
+	SHLight* light;
+	SHLight* amb;
+	glm::vec4 clearColor;
+	glm::vec4 ambColor;
+	SHFilter filter; // Controls how often the particles are re-projected.
+
+	/* Projects n particles (positions given in target space) into SH, as seen
+	 *   from the origin. bbRadius is the radius of a billboard, and colors 
+	 *   should hold the decay texture (as loaded by loadImage()).
+	 */
+	static std::vector<glm::vec3> projectParticles(
+		const AdvectParticle* particles, int n,
+		const glm::mat4& toTarget, float bbRadius,
+		const std::vector<glm::vec4>& colors);
+protected:
+	std::vector<glm::vec4> particleColors;
+private:
+	Renderable* targetObj;
+	std::vector<glm::vec3> projectLight();
+	float intensity;
+	float ambIntensity;
+};
+
+/* AdvectParticlesSHProbes
+ * Lights objects via an SHProbeVolume, rather than owning SH lights for
+ *   a single target object. On each update, the next few probes of the volume
+ *   are re-projected from the particles' positions and decay colours, with 
+ *   each particle treated as a small emitter of its billboard's area.
+ * Receivers (e.g. PRTMesh::setProbeVolume()) sample the volume themselves.
+ * There is no SHFilter, as there is no SHLight to publish to; the volume's
+ *   probesPerFrame bounds the cost of each update instead.
+ */
+class AdvectParticlesSHProbes : public AdvectParticles
+{
+public:
+	AdvectParticlesSHProbes(
+		SHProbeVolume* probes,
+		float intensity,
+		int maxParticles, ParticleShader* shader,
+		Texture* bbTex, Texture* decayTex);
+	void update(int dTime);
+	void onAdd();
+	void setIntensity(float intensity) {this->intensity = intensity;};
+	float getIntensity() {return intensity;};
+	SHProbeVolume* probes;
+protected:
+	glm::vec3 getParticleColor(float decay);
+	std::vector<glm::vec4> particleColors;
+private:
+	void findEmitters();
+	void projectProbe(const glm::vec3& probePos, glm::vec3* coeffts);
+	std::vector<glm::vec3> emitterPos;
+	std::vector<glm::vec3> emitterColor;
+	float intensity;
+	static const float minColor;
+};
+
 #endif
@@ -25,6 +25,7 @@ class Renderable : public Element
 {
 public:
 	Renderable(bool _translucent);
+	virtual ~Renderable() {};
 	const bool translucent;
 	glm::mat4 getModelToWorld() {return modelToWorld;};
 	glm::mat4 getRotation() {return rotation;};
@@ -28,6 +28,72 @@ float SH::realSH(int l, int m, float theta, float phi)
 		return K(l, 0) * P(l, 0, cos(theta));
 }
 
+void SH::evalBasis(int nBands, const glm::vec3& dir, float* basis)
+{
+	/* Uses the same recurrences as P(), applied to P_l^m(z) / sin^m(theta), 
+	 * along with sin^m(theta) * (cos(m*phi), sin(m*phi)) = (x + iy)^m.
+	 */
+	float c = 1.0f; // Re((x + iy)^m)
+	float s = 0.0f; // Im((x + iy)^m)
+	float pmm = 1.0f;
+
+	for(int m = 0; m < nBands; ++m)
+	{
+		if(m > 0)
+		{
+			float cNext = c * dir.x - s * dir.y;
+			s = c * dir.y + s * dir.x;
+			c = cNext;
+			pmm *= -static_cast<float>(2*m - 1);
+		}
+
+		float pPrev = 0.0f;
+		float pCurr = pmm;
+		for(int l = m; l < nBands; ++l)
+		{
+			if(l == m+1)
+			{
+				pPrev = pCurr;
+				pCurr = dir.z * (2*m + 1) * pmm;
+			}
+			else if(l > m+1)
+			{
+				float pNext = ((dir.z * (2*l - 1) * pCurr) - 
+					((l + m - 1) * pPrev)) / static_cast<float>(l - m);
+				pPrev = pCurr;
+				pCurr = pNext;
+			}
+
+			if(m == 0)
+				basis[SHI(l, 0)] = K(l, 0) * pCurr;
+			else
+			{
+				basis[SHI(l,  m)] = SQRT_TWO * K(l, m) * c * pCurr;
+				basis[SHI(l, -m)] = SQRT_TWO * K(l, m) * s * pCurr;
+			}
+		}
+	}
+}
+
+void SH::capZonal(int nBands, float cosAngle, float* zonal)
+{
+	/* Integral of P_l over [cosAngle, 1] is (P_{l-1} - P_{l+1}) / (2l+1),
+	 * with P_l(x) found by the usual Legendre recurrence.
+	 */
+	float pPrev = 1.0f;     // P_{l-1}
+	float pCurr = cosAngle; // P_l
+	zonal[0] = 2.0f * PI * (1.0f - cosAngle);
+
+	for(int l = 1; l < nBands; ++l)
+	{
+		float pNext = (((2*l + 1) * cosAngle * pCurr) - (l * pPrev)) / 
+			static_cast<float>(l + 1);
+		zonal[l] = 2.0f * PI * (pPrev - pNext) / static_cast<float>(2*l + 1);
+		pPrev = pCurr;
+		pCurr = pNext;
+	}
+}
+
 float SH::K(int l, int m)
 {
 	return sqrt(
@@ -24,6 +24,20 @@ namespace SH
 	/* Computes the real spherical harmonic SH_l^m(\theta, \phi) */
 	float realSH(int l, int m, float theta, float phi);
 
+	/* Evaluates all nBands*nBands real SH basis functions in the 
+	 *   (normalised) direction dir, writing them to basis in SHI(l,m) order.
+	 * Gives the same values as realSH(), but without any trig or recursion,
+	 *   so is suitable for use in inner loops.
+	 */
+	void evalBasis(int nBands, const glm::vec3& dir, float* basis);
+
+	/* Finds the zonal coeffts of a spherical cap of angular radius acos(cosAngle)
+	 *   centred on the z-axis, pre-scaled by sqrt(4PI/(2l+1)) so that the
+	 *   projection of a cap centred on dir is zonal[l] * basis[SHI(l,m)], 
+	 *   where basis is from evalBasis(dir).
+	 */
+	void capZonal(int nBands, float cosAngle, float* zonal);
+
 	float K(int l, int m);
 	float P(int l, int m, float x);
 	int fact(int i);
@@ -0,0 +1,263 @@
+#include "SHClip.hpp"
+
+#include "Exception.hpp"
+
+#include <fstream>
+#include <cmath>
+
+namespace
+{
+	const char clipMagic[4] = {'S', 'H', 'C', 'P'};
+}
+
+SHClip::SHClip(const std::string& filename)
+{
+	std::string fullPath = "../models/" + filename;
+	std::ifstream file(fullPath, std::ios::binary);
+
+	if(!file) throw Exception(
+		"SH clip file " + fullPath + " could not be found.\n");
+
+	char magic[4];
+	int nCoeffts;
+	file.read(magic, 4);
+	file.read(reinterpret_cast<char*>(&nCoeffts), sizeof(int));
+	file.read(reinterpret_cast<char*>(&nFrames), sizeof(int));
+	file.read(reinterpret_cast<char*>(&frameTime), sizeof(int));
+	file.read(reinterpret_cast<char*>(&nComponents), sizeof(int));
+
+	if(!file || !std::equal(magic, magic + 4, clipMagic))
+		throw Exception("File " + fullPath + " is not a valid SH clip.\n");
+	if(nCoeffts != GC::nSHCoeffts)
+		throw Exception("SH clip " + fullPath + 
+			" was recorded with a different number of SH bands.\n");
+	if(nFrames <= 0 || frameTime <= 0 || 
+	   nComponents < 0 || nComponents > nValues)
+		throw Exception("SH clip " + fullPath + " has an invalid header.\n");
+
+	// The data must hold exactly what the header describes.
+	std::streamoff dataStart = file.tellg();
+	file.seekg(0, std::ios::end);
+	std::streamoff dataSize = file.tellg() - dataStart;
+	file.seekg(dataStart);
+	std::streamoff expectedSize = 
+		(nValues + (nComponents * nValues) + 2*nComponents) * sizeof(float) + 
+		static_cast<std::streamoff>(nFrames) * nComponents;
+	if(dataSize != expectedSize)
+		throw Exception("SH clip " + fullPath + 
+			" does not match its frame & component counts.\n");
+
+	mean.resize(nValues);
+	components.resize(nComponents * nValues);
+	weightMin.resize(nComponents);
+	weightStep.resize(nComponents);
+	weights.resize(nFrames * nComponents);
+
+	file.read(reinterpret_cast<char*>(mean.data()), mean.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(components.data()), components.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(weightMin.data()), weightMin.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(weightStep.data()), weightStep.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(weights.data()), weights.size());
+
+	if(!file) 
+		throw Exception("SH clip " + fullPath + " is truncated.\n");
+
+	file.close();
+}
+
+void SHClip::write(
+	const std::vector<std::vector<glm::vec3>>& frames,
+	int frameTime, int nComponents, int nBlend,
+	const std::string& filename)
+{
+	int nFrames = static_cast<int>(frames.size()) - nBlend;
+	nComponents = std::min(nComponents, nValues);
+
+	if(nFrames <= 0) throw Exception("Too few frames recorded for SH clip.\n");
+
+	/* Flatten frames, crossfading the tail into the head so that the last
+	 * frame runs smoothly on into the first.
+	 */
+	std::vector<float> data(nFrames * nValues);
+	for(int f = 0; f < nFrames; ++f)
+	{
+		float headWeight = f < nBlend ? 
+			static_cast<float>(f + 1) / static_cast<float>(nBlend + 1) : 1.0f;
+
+		for(int c = 0; c < GC::nSHCoeffts; ++c)
+		{
+			glm::vec3 val = frames[f][c] * headWeight;
+			if(f < nBlend) val += frames[nFrames + f][c] * (1.0f - headWeight);
+
+			data[f*nValues + c*3    ] = val.x;
+			data[f*nValues + c*3 + 1] = val.y;
+			data[f*nValues + c*3 + 2] = val.z;
+		}
+	}
+
+	/* Find mean, and subtract from data. */
+	std::vector<float> mean(nValues, 0.0f);
+	for(int f = 0; f < nFrames; ++f)
+		for(int v = 0; v < nValues; ++v)
+			mean[v] += data[f*nValues + v] / nFrames;
+	for(int f = 0; f < nFrames; ++f)
+		for(int v = 0; v < nValues; ++v)
+			data[f*nValues + v] -= mean[v];
+
+	/* Find covariance matrix. */
+	std::vector<float> cov(nValues * nValues, 0.0f);
+	#pragma omp parallel for
+	for(int i = 0; i < nValues; ++i)
+		for(int j = 0; j < nValues; ++j)
+			for(int f = 0; f < nFrames; ++f)
+				cov[i*nValues + j] += data[f*nValues + i] * data[f*nValues + j];
+
+	/* Find principal components by power iteration, deflating the 
+	 * covariance matrix after each one is found. Vectors are kept orthogonal
+	 * to the components already found, to stop rounding errors creeping in.
+	 * Stops early once the remaining variance is negligible.
+	 */
+	const int nIterations = 100;
+	std::vector<float> components;
+	float firstEigenvalue = 0.0f;
+	for(int k = 0; k < nComponents; ++k)
+	{
+		std::vector<float> vec(nValues);
+		std::vector<float> next(nValues);
+		for(int i = 0; i < nValues; ++i) vec[i] = (i % (k+2)) ? 1.0f : -1.0f;
+
+		float eigenvalue = 0.0f;
+		for(int it = 0; it < nIterations; ++it)
+		{
+			for(int i = 0; i < nValues; ++i)
+			{
+				next[i] = 0.0f;
+				for(int j = 0; j < nValues; ++j)
+					next[i] += cov[i*nValues + j] * vec[j];
+			}
+			for(int prev = 0; prev < k; ++prev)
+			{
+				float d = 0.0f;
+				for(int i = 0; i < nValues; ++i) d += next[i] * components[prev*nValues + i];
+				for(int i = 0; i < nValues; ++i) next[i] -= d * components[prev*nValues + i];
+			}
+			float norm = 0.0f;
+			for(int i = 0; i < nValues; ++i) norm += next[i] * next[i];
+			norm = sqrt(norm);
+			if(norm < EPS) break;
+			for(int i = 0; i < nValues; ++i) vec[i] = next[i] / norm;
+			eigenvalue = norm;
+		}
+
+		if(k == 0) firstEigenvalue = eigenvalue;
+		if(eigenvalue < EPS || eigenvalue < 1e-6f * firstEigenvalue)
+		{
+			nComponents = k;
+			break;
+		}
+
+		components.insert(components.end(), vec.begin(), vec.end());
+		for(int i = 0; i < nValues; ++i)
+			for(int j = 0; j < nValues; ++j)
+				cov[i*nValues + j] -= eigenvalue * vec[i] * vec[j];
+	}
+
+	/* Project frames onto components, and quantize weights. */
+	std::vector<float> projected(nFrames * nComponents, 0.0f);
+	for(int f = 0; f < nFrames; ++f)
+		for(int k = 0; k < nComponents; ++k)
+			for(int v = 0; v < nValues; ++v)
+				projected[f*nComponents + k] += 
+					data[f*nValues + v] * components[k*nValues + v];
+
+	std::vector<float> weightMin(nComponents);
+	std::vector<float> weightStep(nComponents);
+	std::vector<unsigned char> weights(nFrames * nComponents);
+	for(int k = 0; k < nComponents; ++k)
+	{
+		float low = projected[k], high = projected[k];
+		for(int f = 1; f < nFrames; ++f)
+		{
+			low  = std::min(low,  projected[f*nComponents + k]);
+			high = std::max(high, projected[f*nComponents + k]);
+		}
+		weightMin[k] = low;
+		weightStep[k] = (high - low) / 255.0f;
+
+		for(int f = 0; f < nFrames; ++f)
+		{
+			float q = weightStep[k] > 0.0f ? 
+				(projected[f*nComponents + k] - low) / weightStep[k] : 0.0f;
+			weights[f*nComponents + k] = static_cast<unsigned char>(
+				std::min(std::max(q + 0.5f, 0.0f), 255.0f));
+		}
+	}
+
+	/* Write file. */
+	std::string fullPath = "../models/" + filename;
+	std::ofstream file(fullPath, std::ios::binary);
+
+	if(!file) throw Exception("Could not open " + fullPath + " for writing.\n");
+
+	int nCoeffts = GC::nSHCoeffts;
+	file.write(clipMagic, 4);
+	file.write(reinterpret_cast<const char*>(&nCoeffts), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&nFrames), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&frameTime), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&nComponents), sizeof(int));
+	file.write(reinterpret_cast<const char*>(mean.data()), mean.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(components.data()), components.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(weightMin.data()), weightMin.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(weightStep.data()), weightStep.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(weights.data()), weights.size());
+
+	file.close();
+
+	std::cout << "SH clip written to " << fullPath << " (" << nFrames << " frames, "
+		<< nComponents << " components)." << std::endl;
+}
+
+void SHClip::evaluate(float time, std::vector<glm::vec3>& coeffts) const
+{
+	float frame = fmod(time / frameTime, static_cast<float>(nFrames));
+	if(frame < 0.0f) frame += nFrames;
+	int f0 = static_cast<int>(frame) % nFrames;
+	int f1 = (f0 + 1) % nFrames;
+	float t = frame - floor(frame);
+
+	float values[nValues];
+	std::copy(mean.begin(), mean.end(), values);
+
+	for(int k = 0; k < nComponents; ++k)
+	{
+		float w = (1.0f - t) * getWeight(f0, k) + t * getWeight(f1, k);
+		const float* component = &components[k*nValues];
+		for(int v = 0; v < nValues; ++v)
+			values[v] += w * component[v];
+	}
+
+	coeffts.resize(GC::nSHCoeffts);
+	for(int c = 0; c < GC::nSHCoeffts; ++c)
+		coeffts[c] = glm::vec3(values[c*3], values[c*3 + 1], values[c*3 + 2]);
+}
+
+float SHClip::getWeight(int frame, int component) const
+{
+	return weightMin[component] + 
+		weightStep[component] * weights[frame*nComponents + component];
+}
+
+SHClipLight::SHClipLight(SHClip* clip)
+	:SHLight([] (float, float) {return glm::vec3(0.0f);}),
+	 clip(clip), time(0.0f)
+{
+	setIntensity(1.0f);
+	advance(0);
+}
+
+void SHClipLight::advance(int dTime)
+{
+	time = fmod(time + dTime, static_cast<float>(clip->getDuration()));
+	clip->evaluate(time, frame);
+	setCoeffts(frame);
+}
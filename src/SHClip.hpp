@@ -0,0 +1,119 @@
+#ifndef SHCLIP_HPP
+#define SHCLIP_HPP
+
+#include "Light.hpp"
+#include "GC.hpp"
+
+#include <glm.hpp>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+/* SHClip
+ * A looping animation of SH lighting coeffts, e.g. recorded from a fire by
+ *   bake(), for lighting with no simulation or projection at runtime.
+ * Frames are compressed as a mean plus nComponents principal components
+ *   over time, with the weights of each frame quantized to 8 bits.
+ * Clip files are stored in ../models/ alongside the other baked files.
+ */
+class SHClip
+{
+public:
+	SHClip(const std::string& filename);
+
+	/* Runs fire for warmupTime ms so it reaches a steady state, then records
+	 *   its SH light every frameTime ms for duration ms and writes the
+	 *   compressed clip to filename. The last blendTime ms are crossfaded into
+	 *   the start of the clip so that it loops smoothly.
+	 * Fire should be e.g. an AdvectParticlesSHCubemap or
+	 *   AdvectParticlesSHAnalytic which has been added to a scene.
+	 */
+	template<typename Fire>
+	static void bake(
+		Fire* fire,
+		const std::string& filename,
+		int duration,
+		int frameTime = 33,
+		int nComponents = 8,
+		int blendTime = 500,
+		int warmupTime = 3000);
+
+	/* Compresses frames and writes them to a clip file. The last nBlend frames
+	 *   are blended into the first nBlend, so the clip has
+	 *   frames.size() - nBlend frames.
+	 */
+	static void write(
+		const std::vector<std::vector<glm::vec3>>& frames,
+		int frameTime, int nComponents, int nBlend,
+		const std::string& filename);
+
+	/* Finds the coeffts at time (in ms), interpolating between frames.
+	 * time wraps around to the start of the clip.
+	 */
+	void evaluate(float time, std::vector<glm::vec3>& coeffts) const;
+
+	int getDuration() const {return nFrames * frameTime;};
+private:
+	static const int nValues = GC::nSHCoeffts * 3;
+
+	float getWeight(int frame, int component) const;
+
+	int nFrames;
+	int frameTime;
+	int nComponents;
+	std::vector<float> mean;       // nValues floats.
+	std::vector<float> components; // nComponents * nValues floats.
+	std::vector<float> weightMin;  // Per component dequantization range.
+	std::vector<float> weightStep;
+	std::vector<unsigned char> weights; // nFrames * nComponents quantized weights.
+};
+
+/* SHClipLight
+ * An SHLight playing back an SHClip on a loop.
+ * Call advance() once per frame to step the animation.
+ */
+class SHClipLight : public SHLight
+{
+public:
+	SHClipLight(SHClip* clip);
+	void advance(int dTime);
+private:
+	SHClip* clip;
+	float time;
+	std::vector<glm::vec3> frame;
+};
+
+template<typename Fire>
+void SHClip::bake(
+	Fire* fire,
+	const std::string& filename,
+	int duration, int frameTime, int nComponents,
+	int blendTime, int warmupTime)
+{
+	int nFrames = duration / frameTime;
+	int nBlend = std::min(blendTime / frameTime, nFrames);
+
+	std::cout << "Recording SH clip (may take some time) ..." << std::endl;
+
+	// Record with unit intensity, so the clip can be scaled on playback.
+	float intensity = fire->getIntensity();
+	fire->setIntensity(1.0f);
+
+	for(int t = 0; t < warmupTime; t += frameTime)
+		fire->update(frameTime);
+
+	std::vector<std::vector<glm::vec3>> frames;
+	for(int f = 0; f < nFrames + nBlend; ++f)
+	{
+		fire->update(frameTime);
+		frames.push_back(fire->light->getCoeffts());
+	}
+
+	fire->setIntensity(intensity);
+
+	write(frames, frameTime, nComponents, nBlend, filename);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "SHFilter.hpp"
+
+#include "Light.hpp"
+
+#include <iostream>
+
+SHFilter::SHFilter(float smoothing, float threshold, int minInterval)
+	:smoothing(smoothing), threshold(threshold), minInterval(minInterval)
+{
+	reset();
+	resetStats();
+}
+
+void SHFilter::reset()
+{
+	average.clear();
+	published.clear();
+	sinceSample = 0;
+	hasSampled = false;
+}
+
+void SHFilter::resetStats()
+{
+	stats.frames = 0;
+	stats.samples = 0;
+	stats.publishes = 0;
+	stats.sampleTime = 0.0;
+}
+
+void SHFilter::printStats() const
+{
+	std::cout << "SH filter: " << stats.frames << " frames, "
+		<< stats.samples << " samples, "
+		<< stats.publishes << " updates, "
+		<< (stats.samples > 0 ? stats.sampleTime / stats.samples : 0.0) 
+		<< " ms per sample." << std::endl;
+}
+
+bool SHFilter::filter(const std::vector<glm::vec3>& coeffts, SHLight* light)
+{
+	hasSampled = true;
+
+	if(average.size() != coeffts.size())
+		average = coeffts;
+	else
+		for(size_t c = 0; c < coeffts.size(); ++c)
+			average[c] = smoothing * average[c] + (1.0f - smoothing) * coeffts[c];
+
+	if(published.size() == average.size())
+	{
+		float changeSq = 0.0f;
+		float normSq = 0.0f;
+		for(size_t c = 0; c < average.size(); ++c)
+		{
+			glm::vec3 diff = average[c] - published[c];
+			changeSq += glm::dot(diff, diff);
+			normSq += glm::dot(published[c], published[c]);
+		}
+		if(changeSq <= threshold * threshold * normSq) return false;
+	}
+
+	published = average;
+	light->setCoeffts(published);
+	++stats.publishes;
+	return true;
+}
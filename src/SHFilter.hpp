@@ -0,0 +1,92 @@
+#ifndef SHFILTER_HPP
+#define SHFILTER_HPP
+
+#include <glm.hpp>
+
+#include <vector>
+#include <chrono>
+
+class SHLight;
+
+/* SHFilterStats
+ * Counters kept by an SHFilter, to show how much work it saves.
+ * sampleTime is the total time (ms) spent producing coeffts.
+ */
+struct SHFilterStats
+{
+	int frames;
+	int samples;
+	int publishes;
+	double sampleTime;
+};
+
+/* SHFilter
+ * A temporal filter for objects producing SH lighting every frame (e.g.
+ *   AdvectParticlesSHCubemap), to avoid recomputing and re-uploading 
+ *   lighting which has barely changed.
+ * - New coeffts are produced at most once every minInterval ms.
+ * - Produced coeffts are blended into an exponential moving average,
+ *     keeping smoothing of the old average each time (0 disables this).
+ * - The average is only published to the light when its L2 distance from
+ *     the last published coeffts, relative to their L2 norm, exceeds 
+ *     threshold.
+ * The defaults publish every frame, i.e. no filtering.
+ * Only producers which publish whole coeffts through SHLight::setCoeffts()
+ *   can be filtered (AdvectParticlesSHCubemap & AdvectParticlesSHAnalytic).
+ *   AdvectParticlesCentroidSHLights only re-points & tints fixed lobes, and
+ *   AdvectParticlesSHProbes writes to an SHProbeVolume, so neither is.
+ */
+class SHFilter
+{
+public:
+	SHFilter(float smoothing = 0.0f, float threshold = 0.0f, int minInterval = 0);
+
+	/* Called once per frame. If a new sample is due, calls produce() (which
+	 *   should return the new coeffts) and filters the result, publishing it
+	 *   to light if it has changed enough. 
+	 * Returns true if light was updated.
+	 */
+	template<typename Fn>
+	bool update(int dTime, SHLight* light, Fn produce);
+
+	/* Forgets the filter's history, so the next sample is published as is. */
+	void reset();
+
+	const SHFilterStats& getStats() const {return stats;};
+	void resetStats();
+	void printStats() const;
+
+	float smoothing;
+	float threshold;
+	int minInterval;
+private:
+	bool filter(const std::vector<glm::vec3>& coeffts, SHLight* light);
+
+	std::vector<glm::vec3> average;
+	std::vector<glm::vec3> published;
+	int sinceSample;
+	bool hasSampled;
+	SHFilterStats stats;
+};
+
+template<typename Fn>
+bool SHFilter::update(int dTime, SHLight* light, Fn produce)
+{
+	++stats.frames;
+	sinceSample += dTime;
+	if(hasSampled && sinceSample < minInterval) return false;
+	sinceSample = 0;
+
+	std::chrono::high_resolution_clock::time_point start = 
+		std::chrono::high_resolution_clock::now();
+
+	std::vector<glm::vec3> coeffts = produce();
+
+	stats.sampleTime += std::chrono::duration<double, std::milli>(
+		std::chrono::high_resolution_clock::now() - start).count();
+	++stats.samples;
+
+	return filter(coeffts, light);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "SHProbeVolume.hpp"
+
+#include "Exception.hpp"
+
+SHProbeVolume::SHProbeVolume(
+	const glm::vec3& boxMin, const glm::vec3& boxMax,
+	int nx, int ny, int nz,
+	int probesPerFrame)
+	:probesPerFrame(probesPerFrame),
+	 boxMin(boxMin), boxMax(boxMax),
+	 nx(nx), ny(ny), nz(nz),
+	 nextProbe(0)
+{
+	if(nx < 2 || ny < 2 || nz < 2)
+		throw Exception("SHProbeVolume requires at least 2 probes along each axis.\n");
+
+	spacing = (boxMax - boxMin) /
+		glm::vec3(static_cast<float>(nx-1), static_cast<float>(ny-1), static_cast<float>(nz-1));
+
+	coeffts.resize(getNProbes() * GC::nSHCoeffts, glm::vec3(0.0f));
+}
+
+glm::vec3 SHProbeVolume::getProbePos(int probe) const
+{
+	int x = probe % nx;
+	int y = (probe / nx) % ny;
+	int z = probe / (nx * ny);
+	return boxMin + spacing * glm::vec3(
+		static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+}
+
+std::vector<glm::vec3> SHProbeVolume::sample(const glm::vec3& pos) const
+{
+	// Find position in grid space, clamped to the volume.
+	glm::vec3 g = glm::clamp((pos - boxMin) / spacing, glm::vec3(0.0f),
+		glm::vec3(static_cast<float>(nx-1), static_cast<float>(ny-1), static_cast<float>(nz-1)));
+
+	int x0 = std::min(static_cast<int>(g.x), nx-2);
+	int y0 = std::min(static_cast<int>(g.y), ny-2);
+	int z0 = std::min(static_cast<int>(g.z), nz-2);
+
+	float fx = g.x - x0;
+	float fy = g.y - y0;
+	float fz = g.z - z0;
+
+	std::vector<glm::vec3> result(GC::nSHCoeffts, glm::vec3(0.0f));
+
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+		float weight =
+			(dx ? fx : 1.0f - fx) *
+			(dy ? fy : 1.0f - fy) *
+			(dz ? fz : 1.0f - fz);
+		if(weight <= 0.0f) continue;
+
+		const glm::vec3* probe =
+			&coeffts[probeIndex(x0 + dx, y0 + dy, z0 + dz) * GC::nSHCoeffts];
+		for(int c = 0; c < GC::nSHCoeffts; ++c)
+			result[c] += weight * probe[c];
+	}
+
+	return result;
+}
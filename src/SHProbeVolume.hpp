@@ -0,0 +1,88 @@
+#ifndef SHPROBEVOLUME_HPP
+#define SHPROBEVOLUME_HPP
+
+#include "GC.hpp"
+
+#include <glm.hpp>
+
+#include <vector>
+#include <algorithm>
+
+/* SHProbeVolume
+ * A regular grid of SH irradiance probes filling the box [boxMin, boxMax]
+ *   in world space, with nx * ny * nz probes placed on the box's corners
+ *   and along its edges.
+ * Probes are refreshed in round-robin order, probesPerFrame at a time, by
+ *   calling refresh() with a function projecting the lighting at a point.
+ *   This keeps the cost per frame fixed, however many objects are lit.
+ * Receivers call sample() to get trilinearly interpolated SH coeffts
+ *   (in world space orientation) at any point. Points outside the box are
+ *   clamped to it.
+ */
+class SHProbeVolume
+{
+public:
+	SHProbeVolume(
+		const glm::vec3& boxMin, const glm::vec3& boxMax,
+		int nx, int ny, int nz,
+		int probesPerFrame);
+
+	/* Refreshes the next probesPerFrame probes.
+	 * project should have the signature
+	 *   void project(const glm::vec3& pos, glm::vec3* coeffts)
+	 *   and write GC::nSHCoeffts coeffts for the lighting at pos.
+	 * project is called from several threads at once, so must be thread-safe.
+	 */
+	template<typename Fn>
+	void refresh(Fn project);
+	/* As above, but refreshes every probe (e.g. to fill the volume initially). */
+	template<typename Fn>
+	void refreshAll(Fn project);
+
+	std::vector<glm::vec3> sample(const glm::vec3& pos) const;
+
+	glm::vec3 getProbePos(int probe) const;
+	int getNProbes() const {return static_cast<int>(nx * ny * nz);};
+
+	int probesPerFrame;
+	const glm::vec3 boxMin;
+	const glm::vec3 boxMax;
+	const int nx, ny, nz;
+private:
+	int probeIndex(int x, int y, int z) const {return x + nx*(y + ny*z);};
+	template<typename Fn>
+	void refreshRange(int first, int count, Fn project);
+
+	glm::vec3 spacing;
+	int nextProbe;
+	std::vector<glm::vec3> coeffts; // GC::nSHCoeffts per probe, stored contiguously.
+};
+
+template<typename Fn>
+void SHProbeVolume::refresh(Fn project)
+{
+	int count = std::min(probesPerFrame, getNProbes());
+	refreshRange(nextProbe, count, project);
+	nextProbe = (nextProbe + count) % getNProbes();
+}
+
+template<typename Fn>
+void SHProbeVolume::refreshAll(Fn project)
+{
+	refreshRange(0, getNProbes(), project);
+}
+
+template<typename Fn>
+void SHProbeVolume::refreshRange(int first, int count, Fn project)
+{
+	int nProbes = getNProbes();
+
+	#pragma omp parallel for
+	for(int i = 0; i < count; ++i)
+	{
+		int probe = (first + i) % nProbes;
+		project(getProbePos(probe), &coeffts[probe * GC::nSHCoeffts]);
+	}
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "SHReduction.hpp"
+
+#include "Shader.hpp"
+#include "Texture.hpp"
+#include "GC.hpp"
+
+/* Creates a nearest-filtered RGBA32F texture in the given texture unit,
+ *   filled with zeros.
+ */
+static GLuint genFloatTex(int width, int height, GLuint unit)
+{
+	std::vector<glm::vec4> zeros(width * height, glm::vec4(0.0f));
+
+	GLuint tex;
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, 
+		GL_RGBA, GL_FLOAT, zeros.data());
+	return tex;
+}
+
+SHReduction::SHReduction(int faceSize)
+	:scale(1.0f), faceSize(faceSize)
+{
+	projectShader = new SHProjectShader("SHProjectCubemap");
+	reduceShader = new SHReduceShader("SHReduce");
+	projectShader->setFaceSize(faceSize);
+
+	for(int i = 0; i < 2; ++i)
+	{
+		rowTexUnit[i] = Texture::genTexUnit();
+		rowTex[i] = genFloatTex(GC::nSHCoeffts, 6 * faceSize, rowTexUnit[i]);
+	}
+	coefftTexUnit = Texture::genTexUnit();
+	coefftTex = genFloatTex(GC::nSHCoeffts, 1, coefftTexUnit);
+
+	glGenRenderbuffers(1, &mergeRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, mergeRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, GC::nSHCoeffts, 1);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glGenVertexArrays(1, &vao);
+}
+
+SHReduction::~SHReduction()
+{
+	delete projectShader;
+	delete reduceShader;
+	glDeleteTextures(2, rowTex);
+	glDeleteTextures(1, &coefftTex);
+	glDeleteRenderbuffers(1, &mergeRenderbuffer);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteVertexArrays(1, &vao);
+}
+
+void SHReduction::project(GLuint cubemapTexUnit)
+{
+	saveState();
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glBindVertexArray(vao);
+	glDisable(GL_BLEND);
+
+	// Integrate each row of each face against each basis function.
+	int rows = 6 * faceSize;
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+		GL_TEXTURE_2D, rowTex[0], 0);
+	glViewport(0, 0, GC::nSHCoeffts, rows);
+	projectShader->setCubemapTexUnit(cubemapTexUnit);
+	projectShader->use();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	// Sum blocks of rows until only one is left.
+	int src = 0;
+	while(rows > 1)
+	{
+		int dstRows = (rows + blockSize - 1) / blockSize;
+		GLuint dst = (dstRows == 1) ? coefftTex : rowTex[1 - src];
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+			GL_TEXTURE_2D, dst, 0);
+		glViewport(0, 0, GC::nSHCoeffts, dstRows);
+		reduce(rowTexUnit[src], rows, blockSize, false);
+
+		src = 1 - src;
+		rows = dstRows;
+	}
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+		GL_TEXTURE_2D, 0, 0);
+	restoreState();
+}
+
+void SHReduction::addTo(GLuint blockUBO)
+{
+	saveState();
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+		GL_RENDERBUFFER, mergeRenderbuffer);
+	glBindVertexArray(vao);
+	glDisable(GL_BLEND);
+
+	// Add scaled coeffts onto those in the block.
+	glViewport(0, 0, GC::nSHCoeffts, 1);
+	reduce(coefftTexUnit, 1, 1, true);
+
+	// Copy the sum back over the block. As the block is bound as the pack
+	// buffer, this is a copy within GPU memory.
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, blockUBO);
+	glReadPixels(0, 0, GC::nSHCoeffts, 1, GL_RGBA, GL_FLOAT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+		GL_RENDERBUFFER, 0);
+	restoreState();
+}
+
+std::vector<glm::vec3> SHReduction::readCoeffts()
+{
+	std::vector<glm::vec4> texels(GC::nSHCoeffts);
+	glActiveTexture(GL_TEXTURE0 + coefftTexUnit);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, texels.data());
+
+	std::vector<glm::vec3> coeffts;
+	for(auto i = texels.begin(); i != texels.end(); ++i)
+		coeffts.push_back(glm::vec3(*i));
+	return coeffts;
+}
+
+void SHReduction::reduce(GLuint srcUnit, int srcRows, int rowsPerTexel, bool addBlock)
+{
+	reduceShader->setSrcTexUnit(srcUnit);
+	reduceShader->setSrcRows(srcRows);
+	reduceShader->setBlockSize(rowsPerTexel);
+	reduceShader->setScale(addBlock ? scale : glm::vec3(1.0f));
+	reduceShader->setAddBlock(addBlock);
+	reduceShader->use();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void SHReduction::saveState()
+{
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, prevViewport);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVAO);
+	glGetBooleanv(GL_BLEND, &prevBlend);
+}
+
+void SHReduction::restoreState()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+	glUseProgram(prevProgram);
+	glBindVertexArray(prevVAO);
+	if(prevBlend == GL_TRUE) glEnable(GL_BLEND);
+	else glDisable(GL_BLEND);
+}
@@ -0,0 +1,59 @@
+#ifndef SHREDUCTION_HPP
+#define SHREDUCTION_HPP
+
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include <vector>
+
+class SHProjectShader;
+class SHReduceShader;
+
+/* SHReduction
+ * Projects a cubemap onto SH entirely on the GPU, so no pixels need to be
+ *   read back. The cubemap is a 6 layer 2D array texture, one layer per face,
+ *   as rendered by AdvectParticlesSHCubemap.
+ * project() integrates every texel against each basis function in a fragment
+ *   shader (SHProjectCubemap.glsl), then sums the results in a series of
+ *   reduction passes (SHReduce.glsl), leaving the coeffts in a small texture.
+ * addTo() adds the coeffts, multiplied by scale, onto the SHBlock uniform
+ *   buffer, again on the GPU. SHLightManager calls this for each of its GPU
+ *   sources whenever it uploads the block.
+ * readCoeffts() reads the coeffts back, e.g. to validate against the CPU.
+ */
+class SHReduction
+{
+public:
+	SHReduction(int faceSize);
+	~SHReduction();
+	void project(GLuint cubemapTexUnit);
+	void addTo(GLuint blockUBO);
+	std::vector<glm::vec3> readCoeffts();
+	glm::vec3 scale;
+private:
+	static const int blockSize = 16; // Rows summed by each reduction pass.
+
+	void reduce(GLuint srcUnit, int srcRows, int rowsPerTexel, bool addBlock);
+	void saveState();
+	void restoreState();
+
+	int faceSize;
+	SHProjectShader* projectShader;
+	SHReduceShader* reduceShader;
+	GLuint framebuffer;
+	GLuint vao;
+	// Ping-pong textures for the reduction passes, each bound to its own unit.
+	GLuint rowTex[2];
+	GLuint rowTexUnit[2];
+	GLuint coefftTex;
+	GLuint coefftTexUnit;
+	GLuint mergeRenderbuffer; // Target for addTo(), never sampled.
+
+	GLint prevFramebuffer;
+	GLint prevViewport[4];
+	GLint prevProgram;
+	GLint prevVAO;
+	GLboolean prevBlend;
+};
+
+#endif
@@ -19,8 +19,14 @@ std::string sh_subs[2] =
 };
 
 
+std::string batch_subs[2] = 
+{
+	"$maxBatchEmitters$", std::to_string(static_cast<long long>(GC::maxBatchEmitters))
+};
+
 const std::vector<std::string> Shader::PHONG_SUBS(phong_subs, phong_subs+2);
 const std::vector<std::string> Shader::SH_SUBS(sh_subs, sh_subs+2);
+const std::vector<std::string> Shader::BATCH_SUBS(batch_subs, batch_subs+2);
 
 Shader::Shader(bool hasGeomShader, const std::string& filename,
 	bool hasCamera, bool hasModelToWorld)
@@ -182,6 +188,7 @@ GLuint Shader::getUBlockBindingIndex(const std::string& name)
 	if (name.compare("ambBlock")    == 0) return 1;
 	if (name.compare("phongBlock")  == 0) return 2;
 	if (name.compare("SHBlock")     == 0) return 3;
+	if (name.compare("emitterBlock") == 0) return 4;
 	return -1; // Name not found
 }
 
@@ -216,6 +223,23 @@ void Shader::setupUniformBlock(const std::string& name)
 	glUniformBlockBinding(id, unfIndex, bindIndex);
 }
 
+void Shader::setFeedbackVaryings(const std::vector<std::string>& varyings)
+{
+	std::vector<const GLchar*> names;
+	for(auto i = varyings.begin(); i != varyings.end(); ++i)
+		names.push_back(i->c_str());
+
+	glTransformFeedbackVaryings(id, static_cast<GLsizei>(names.size()), names.data(),
+		GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(id);
+
+	GLint linked;
+	glGetProgramiv(id, GL_LINK_STATUS, &linked);
+	if(!linked)
+		throw Exception("Shader from filename " + filename + 
+			" could not be linked with transform feedback varyings.\n");
+}
+
 LightShader::LightShader(bool hasGeometry, const std::string& filename)
 	:Shader(hasGeometry, filename, PHONG_SUBS), maxPhongLights(50)
 {
@@ -320,12 +344,13 @@ void ParticleShader::setDecayTexUnit(GLuint _decayTexUnit)
 }
 
 CubemapShader::CubemapShader(
-	bool hasGeomShader, bool hasBBTex, const std::string& filename)
+	bool hasGeomShader, bool hasBBTex, const std::string& filename, bool layered)
 	:ParticleShader(hasGeomShader, hasBBTex, filename, false, true)
 {
 	use();
 	worldToObject_u = getUniformLoc("worldToObject");
-	rotation_u = getUniformLoc("rotation");
+	if(layered) faceRotations_u = getUniformLoc("faceRotations");
+	else rotation_u = getUniformLoc("rotation");
 	perspective_u = getUniformLoc("perspective");
 	glm::mat4 perspective = glm::perspective(90.0f, 1.0f, 0.01f, 50.0f);
 	glUniformMatrix4fv(perspective_u, 1, GL_FALSE, &(perspective[0][0]));
@@ -345,6 +370,13 @@ void CubemapShader::setRotation(const glm::mat4& rotation)
 	glUniformMatrix4fv(rotation_u, 1, GL_FALSE, &(rotation[0][0]));
 }
 
+void CubemapShader::setFaceRotations(const glm::mat4* rotations)
+{
+	use();
+	glUniformMatrix4fv(faceRotations_u, 6, GL_FALSE, &(rotations[0][0][0]));
+	glUseProgram(0);
+}
+
 SHShader::SHShader(bool hasGeomShader,  const std::string& filename)
 	:Shader(hasGeomShader, filename, SH_SUBS)
 {
@@ -385,3 +417,162 @@ AOShader::AOShader(bool hasGeomShader,  const std::string& filename,
 	setupUniformBlock("ambBlock");
 	setupUniformBlock("PhongBlock");
 }
+
+SHProjectShader::SHProjectShader(const std::string& filename)
+	:Shader(false, filename, false, false)
+{
+	cubemapTex_u = getUniformLoc("cubemap");
+	faceSize_u = getUniformLoc("faceSize");
+}
+
+void SHProjectShader::setCubemapTexUnit(GLuint unit)
+{
+	use();
+	glUniform1i(cubemapTex_u, unit);
+	glUseProgram(0);
+}
+
+void SHProjectShader::setFaceSize(int faceSize)
+{
+	use();
+	glUniform1i(faceSize_u, faceSize);
+	glUseProgram(0);
+}
+
+SHReduceShader::SHReduceShader(const std::string& filename)
+	:Shader(false, filename, SH_SUBS, false, false)
+{
+	srcTex_u = getUniformLoc("src");
+	srcRows_u = getUniformLoc("srcRows");
+	blockSize_u = getUniformLoc("blockSize");
+	scale_u = getUniformLoc("scale");
+	addBlock_u = getUniformLoc("addBlock");
+	setupUniformBlock("SHBlock");
+}
+
+void SHReduceShader::setSrcTexUnit(GLuint unit)
+{
+	use();
+	glUniform1i(srcTex_u, unit);
+	glUseProgram(0);
+}
+
+void SHReduceShader::setSrcRows(int rows)
+{
+	use();
+	glUniform1i(srcRows_u, rows);
+	glUseProgram(0);
+}
+
+void SHReduceShader::setBlockSize(int blockSize)
+{
+	use();
+	glUniform1i(blockSize_u, blockSize);
+	glUseProgram(0);
+}
+
+void SHReduceShader::setScale(const glm::vec3& scale)
+{
+	use();
+	glUniform3fv(scale_u, 1, &(scale[0]));
+	glUseProgram(0);
+}
+
+void SHReduceShader::setAddBlock(bool addBlock)
+{
+	use();
+	glUniform1i(addBlock_u, addBlock ? 1 : 0);
+	glUseProgram(0);
+}
+
+ParticleBatchShader::ParticleBatchShader(const std::string& filename)
+	:Shader(true, filename, BATCH_SUBS, true, false)
+{
+	use();
+	bbTex_u = getUniformLoc("bbTexture");
+	decayTex_u = getUniformLoc("decayTexture");
+	setupUniformBlock("emitterBlock");
+	glUseProgram(0);
+}
+
+void ParticleBatchShader::setBBTexUnit(GLuint unit)
+{
+	use();
+	glUniform1i(bbTex_u, unit);
+	glUseProgram(0);
+}
+
+void ParticleBatchShader::setDecayTexUnit(GLuint unit)
+{
+	use();
+	glUniform1i(decayTex_u, unit);
+	glUseProgram(0);
+}
+
+ParticleUpdateShader::ParticleUpdateShader(const std::string& filename)
+	:Shader(false, filename, false, false)
+{
+	std::vector<std::string> varyings;
+	varyings.push_back("outPosDecay");
+	varyings.push_back("outVelRandTex");
+	varyings.push_back("outTimers");
+	setFeedbackVaryings(varyings);
+
+	use();
+	dTime_u = getUniformLoc("dTime");
+	seed_u = getUniformLoc("seed");
+	initAcn_u = getUniformLoc("initAcn");
+	extForce_u = getUniformLoc("extForce");
+	centerForce_u = getUniformLoc("centerForce");
+	baseRadius_u = getUniformLoc("baseRadius");
+	initVel_u = getUniformLoc("initVel");
+	initUpVel_u = getUniformLoc("initUpVel");
+	avgLifetime_u = getUniformLoc("avgLifetime");
+	varLifetime_u = getUniformLoc("varLifetime");
+	perturbOn_u = getUniformLoc("perturbOn");
+	perturbRadius_u = getUniformLoc("perturbRadius");
+	avgPerturbTime_u = getUniformLoc("avgPerturbTime");
+	varPerturbTime_u = getUniformLoc("varPerturbTime");
+	glUseProgram(0);
+}
+
+void ParticleUpdateShader::setStep(float dTime, int seed)
+{
+	use();
+	glUniform1f(dTime_u, dTime);
+	glUniform1i(seed_u, seed);
+	glUseProgram(0);
+}
+
+void ParticleUpdateShader::setForces(
+	const glm::vec4& initAcn, const glm::vec4& extForce, float centerForce)
+{
+	use();
+	glUniform4fv(initAcn_u, 1, &(initAcn[0]));
+	glUniform4fv(extForce_u, 1, &(extForce[0]));
+	glUniform1f(centerForce_u, centerForce);
+	glUseProgram(0);
+}
+
+void ParticleUpdateShader::setSpawn(float baseRadius, float initVel, float initUpVel, 
+	float avgLifetime, float varLifetime)
+{
+	use();
+	glUniform1f(baseRadius_u, baseRadius);
+	glUniform1f(initVel_u, initVel);
+	glUniform1f(initUpVel_u, initUpVel);
+	glUniform1f(avgLifetime_u, avgLifetime);
+	glUniform1f(varLifetime_u, varLifetime);
+	glUseProgram(0);
+}
+
+void ParticleUpdateShader::setPerturb(bool perturbOn, float perturbRadius, 
+	float avgPerturbTime, float varPerturbTime)
+{
+	use();
+	glUniform1i(perturbOn_u, perturbOn ? 1 : 0);
+	glUniform1f(perturbRadius_u, perturbRadius);
+	glUniform1f(avgPerturbTime_u, avgPerturbTime);
+	glUniform1f(varPerturbTime_u, varPerturbTime);
+	glUseProgram(0);
+}
@@ -43,9 +43,14 @@ public:
 protected:
 	GLuint getUniformLoc(const std::string& name);
 	void setupUniformBlock(const std::string& name);
+	/* Captures the named vertex shader outputs with transform feedback, 
+	 *   interleaved into a single buffer. Relinks the program.
+	 */
+	void setFeedbackVaryings(const std::vector<std::string>& varyings);
 
 	static const std::vector<std::string> PHONG_SUBS;
 	static const std::vector<std::string> SH_SUBS;
+	static const std::vector<std::string> BATCH_SUBS;
 private:
 	GLuint id;
 	GLuint loadShader(const std::string& filename,
@@ -78,16 +83,69 @@ private:
 	GLuint decayTex_u;
 };
 
+/* ParticleBatchShader
+ * A particle shader for a ParticleBatch. In place of modelToWorld, bbWidth,
+ *   bbHeight & globalAlpha uniforms, each particle's values are looked up
+ *   in the emitterBlock uniform block by its vEmitter attrib.
+ */
+class ParticleBatchShader : public Shader
+{
+public:
+	ParticleBatchShader(const std::string& filename);
+	void setBBTexUnit(GLuint unit);
+	void setDecayTexUnit(GLuint unit);
+private:
+	GLuint bbTex_u;
+	GLuint decayTex_u;
+};
+
+/* ParticleUpdateShader
+ * Advances the state of GPUAdvectParticles by one step, with the new state
+ *   captured by transform feedback.
+ */
+class ParticleUpdateShader : public Shader
+{
+public:
+	ParticleUpdateShader(const std::string& filename);
+	void setStep(float dTime, int seed);
+	void setForces(const glm::vec4& initAcn, const glm::vec4& extForce, float centerForce);
+	void setSpawn(float baseRadius, float initVel, float initUpVel, 
+		float avgLifetime, float varLifetime);
+	void setPerturb(bool perturbOn, float perturbRadius, 
+		float avgPerturbTime, float varPerturbTime);
+private:
+	GLuint dTime_u;
+	GLuint seed_u;
+	GLuint initAcn_u;
+	GLuint extForce_u;
+	GLuint centerForce_u;
+	GLuint baseRadius_u;
+	GLuint initVel_u;
+	GLuint initUpVel_u;
+	GLuint avgLifetime_u;
+	GLuint varLifetime_u;
+	GLuint perturbOn_u;
+	GLuint perturbRadius_u;
+	GLuint avgPerturbTime_u;
+	GLuint varPerturbTime_u;
+};
+
 class CubemapShader : public ParticleShader
 {
 public:
-	CubemapShader(bool hasGeomShader, bool hasBBTex, const std::string& filename);
+	/* If layered is true, the shader renders all six faces at once, and takes
+	 *   an array of six faceRotations in place of a single rotation.
+	 */
+	CubemapShader(bool hasGeomShader, bool hasBBTex, const std::string& filename,
+		bool layered = false);
 	void setWorldToObject(const glm::mat4& worldToObject);
 	void setRotation(const glm::mat4& rotation);
+	void setFaceRotations(const glm::mat4* rotations);
 	void setPerspective(const glm::mat4& perspective);
 private:
 	GLuint worldToObject_u;
 	GLuint rotation_u;
+	GLuint faceRotations_u;
 	GLuint perspective_u;
 };
 
@@ -141,4 +199,36 @@ public:
 		std::vector<std::string> subs);
 };
 
+/* SHProjectShader & SHReduceShader
+ * Shaders for the passes of an SHReduction, which draw a full screen quad
+ *   with no camera, model transform or vertex attributes.
+ */
+class SHProjectShader : public Shader
+{
+public:
+	SHProjectShader(const std::string& filename);
+	void setCubemapTexUnit(GLuint unit);
+	void setFaceSize(int faceSize);
+private:
+	GLuint cubemapTex_u;
+	GLuint faceSize_u;
+};
+
+class SHReduceShader : public Shader
+{
+public:
+	SHReduceShader(const std::string& filename);
+	void setSrcTexUnit(GLuint unit);
+	void setSrcRows(int rows);
+	void setBlockSize(int blockSize);
+	void setScale(const glm::vec3& scale);
+	void setAddBlock(bool addBlock);
+private:
+	GLuint srcTex_u;
+	GLuint srcRows_u;
+	GLuint blockSize_u;
+	GLuint scale_u;
+	GLuint addBlock_u;
+};
+
 #endif
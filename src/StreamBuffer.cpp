@@ -0,0 +1,61 @@
+#include "StreamBuffer.hpp"
+
+#include "Exception.hpp"
+
+StreamBuffer::StreamBuffer(GLsizeiptr regionSize, int nRegions)
+	:regionSize(regionSize), nRegions(nRegions), region(0)
+{
+	if(nRegions < 1 || nRegions > GC::nStreamRegions)
+		throw Exception("StreamBuffer must have between 1 and GC::nStreamRegions regions.\n");
+
+	for(int i = 0; i < nRegions; ++i)
+		fences[i] = 0;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, regionSize * nRegions, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for(int i = 0; i < nRegions; ++i)
+		if(fences[i]) glDeleteSync(fences[i]);
+
+	glDeleteBuffers(1, &buffer);
+}
+
+void* StreamBuffer::map()
+{
+	// Every draw from the current region has now been issued.
+	if(fences[region]) glDeleteSync(fences[region]);
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	region = (region + 1) % nRegions;
+
+	// Wait until the GPU has finished drawing from the region to be reused.
+	if(fences[region])
+	{
+		GLenum result = glClientWaitSync(fences[region], 0, 0);
+		while(result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fences[region], 
+				GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, getOffset(), regionSize,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(!ptr)
+		throw Exception("Failed to map StreamBuffer region.\n");
+	return ptr;
+}
+
+void StreamBuffer::unmap()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,44 @@
+#ifndef STREAMBUFFER_HPP
+#define STREAMBUFFER_HPP
+
+#include "GC.hpp"
+
+#include <GL/glew.h>
+
+/* StreamBuffer
+ * A vertex buffer for data which is rewritten every frame, e.g. particles.
+ * The buffer is split into nRegions regions of regionSize bytes, written in
+ *   turn, so the CPU fills one region while the GPU may still be drawing
+ *   from the others. A fence is placed on each region when moving on from
+ *   it, and map() only waits if the GPU has not finished with the region
+ *   being reused (i.e. the CPU is nRegions frames ahead).
+ * Each region is mapped unsynchronized as it is written, as the fences
+ *   already keep the CPU from overwriting anything still being drawn.
+ * Vertex attribs should point at the start of the buffer, with draws
+ *   starting from getFirst(stride) to use the current region.
+ */
+class StreamBuffer
+{
+public:
+	StreamBuffer(GLsizeiptr regionSize, int nRegions = GC::nStreamRegions);
+	~StreamBuffer();
+
+	/* Moves on to the next region & returns a pointer to write it through.
+	 * The pointer is valid until unmap().
+	 */
+	void* map();
+	void unmap();
+
+	GLuint getBuffer() const {return buffer;};
+	GLintptr getOffset() const {return region * regionSize;};
+	GLint getFirst(GLsizei stride) const 
+		{return static_cast<GLint>(getOffset() / stride);};
+private:
+	const GLsizeiptr regionSize;
+	const int nRegions;
+	GLuint buffer;
+	int region;
+	GLsync fences[GC::nStreamRegions];
+};
+
+#endif